@@ -0,0 +1,137 @@
+// Address-space identifiers.
+//
+// satp carries an ASID next to the page-table address, and the
+// TLB tags each user entry with it, so entries of different
+// processes can sit in the TLB together and a context switch
+// does not have to flush it. The kernel page table uses ASID 0.
+//
+// Each hart hands out its own ASIDs, tagged with a generation
+// number. When a hart runs out, it starts a new generation and
+// flushes its whole TLB once; a process whose ASID on that hart
+// is from an older generation gets a new one when it next runs
+// there.
+//
+// A process can have TLB entries on every hart it has run on.
+// When its page table changes, tlb_flush() and tlb_flush_page()
+// use an address- and ASID-specific sfence.vma on the current
+// hart, and make the process forget its ASIDs on the others:
+// when it runs there again it gets a fresh ASID, which has no
+// entries, stale or otherwise.
+//
+// If the MMU implements no ASID bits, or the kernel is built
+// with NOASID, trampoline.S flushes the TLB on every page-table
+// switch, as it always used to.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "memstat.h"
+
+static uint64 asidmax;     // largest ASID the MMU supports, 0 if none
+static uint64 nrollover;   // new generations started, all harts
+
+// Find out how many ASID bits satp implements by writing ones
+// to the field and reading back what sticks. Called by each
+// hart once paging is on.
+void
+asidinit(void)
+{
+  struct cpu *c = mycpu();
+
+#ifdef NOASID
+  asidmax = 0;
+#else
+  uint64 satp = r_satp();
+
+  w_satp(satp | SATP_ASID_MASK);
+  asidmax = (r_satp() & SATP_ASID_MASK) >> SATP_ASID_SHIFT;
+  w_satp(satp);
+  sfence_vma();
+#endif
+
+  c->asidgen = 1;
+  c->nextasid = 1;
+}
+
+// Return the satp value that runs p on this hart, first
+// giving p an ASID here if it has none from this hart's
+// current generation. Sets *flush if the MMU has no ASIDs,
+// so trampoline.S must flush the TLB instead.
+// Called with interrupts off.
+uint64
+asid_satp(struct proc *p, int *flush)
+{
+  struct cpu *c = mycpu();
+  int id = cpuid();
+
+  *flush = (asidmax == 0);
+  if(asidmax == 0)
+    return MAKE_SATP(p->pagetable);
+
+  if((p->asid[id] >> 16) != c->asidgen){
+    if(c->nextasid > asidmax){
+      // Out of ASIDs. Any of them may still tag entries
+      // in this hart's TLB.
+      c->asidgen++;
+      c->nextasid = 1;
+      sfence_vma();
+      __sync_fetch_and_add(&nrollover, 1);
+    }
+    p->asid[id] = (c->asidgen << 16) | c->nextasid++;
+  }
+  return MAKE_SATP_ASID(p->pagetable, p->asid[id] & 0xffff);
+}
+
+// Flush this hart's TLB entries for p, only those for va
+// unless all is set, and forget p's ASIDs on other harts.
+// p must be the current process, or not running and locked.
+static void
+flush(struct proc *p, uint64 va, int all)
+{
+  int id;
+  uint64 asid;
+
+  if(asidmax == 0)
+    return;  // trampoline.S flushes on every switch
+
+  push_off();
+  id = cpuid();
+  for(int i = 0; i < NCPU; i++)
+    if(i != id)
+      p->asid[i] = 0;
+  asid = p->asid[id];
+  if((asid >> 16) == mycpu()->asidgen){
+    if(all)
+      sfence_vma_asid(asid & 0xffff);
+    else
+      sfence_vma_page(va, asid & 0xffff);
+  }
+  pop_off();
+}
+
+// p's page table changed in many places, or was replaced:
+// drop all of p's TLB entries.
+void
+tlb_flush(struct proc *p)
+{
+  flush(p, 0, 1);
+}
+
+// The PTE for va in p's page table changed, or a megapage
+// covering va did: drop the TLB entries for it.
+void
+tlb_flush_page(struct proc *p, uint64 va)
+{
+  flush(p, va, 0);
+}
+
+void
+asidstat(struct memstat *ms)
+{
+  ms->asids = asidmax;
+  ms->nasidroll = nrollover;
+}
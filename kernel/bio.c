@@ -136,6 +136,57 @@ brelse(struct buf *b)
   release(&bcache.lock);
 }
 
+// Release a locked buffer whose contents the caller has
+// copied elsewhere, such as file data now in the page cache.
+// Move it to the tail of the list, to be recycled first.
+void
+bdone(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bdone");
+
+  releasesleep(&b->lock);
+
+  acquire(&bcache.lock);
+  b->refcnt--;
+  if (b->refcnt == 0) {
+    b->next->prev = b->prev;
+    b->prev->next = b->next;
+    b->next = &bcache.head;
+    b->prev = bcache.head.prev;
+    bcache.head.prev->next = b;
+    bcache.head.prev = b;
+  }
+  
+  release(&bcache.lock);
+}
+
+// If block blockno is in the cache, copy its contents to dst
+// and return 1; else return 0. For a reader that goes to the
+// disk directly, which must still see writes the log has not
+// installed yet.
+int
+bpeek(uint dev, uint blockno, void *dst)
+{
+  struct buf *b;
+  int valid;
+
+  acquire(&bcache.lock);
+  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+    if(b->dev == dev && b->blockno == blockno){
+      b->refcnt++;
+      release(&bcache.lock);
+      acquiresleep(&b->lock);
+      if((valid = b->valid) != 0)
+        memmove(dst, b->data, BSIZE);
+      bdone(b);
+      return valid;
+    }
+  }
+  release(&bcache.lock);
+  return 0;
+}
+
 void
 bpin(struct buf *b) {
   acquire(&bcache.lock);
@@ -112,8 +112,18 @@ consoleread(int user_dst, uint64 dst, int n)
 
     // copy the input byte to the user-space buffer.
     cbuf = c;
-    if(either_copyout(user_dst, dst, &cbuf, 1) == -1)
-      break;
+    if(either_copyout(user_dst, dst, &cbuf, 1) == -1){
+      // Swapped out while we slept, or copy-on-write? Fix the
+      // page up without the lock and take the byte again.
+      cons.r--;
+      if(!user_dst)
+        break;
+      release(&cons.lock);
+      if(uvmfault(myproc()->pagetable, dst, 1) < 0)
+        return target - n;
+      acquire(&cons.lock);
+      continue;
+    }
 
     dst++;
     --n;
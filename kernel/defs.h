@@ -5,11 +5,15 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct kmem_cache;
 struct pipe;
 struct proc;
 struct spinlock;
 struct sleeplock;
 struct stat;
+struct slabstat;
+struct memstat;
+struct kallocsite;
 struct superblock;
 
 // EEVD scheduler data structure
@@ -19,10 +23,19 @@ struct eevdf_data {
   long sum_weighted_diff;
 };
 
+// asid.c
+void            asidinit(void);
+uint64          asid_satp(struct proc*, int*);
+void            tlb_flush(struct proc*);
+void            tlb_flush_page(struct proc*, uint64);
+void            asidstat(struct memstat*);
+
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
+void            bdone(struct buf*);
+int             bpeek(uint, uint, void*);
 void            bwrite(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
@@ -34,6 +47,7 @@ void            consputc(int);
 
 // exec.c
 int             exec(char*, char**);
+int             execfault(struct proc*, uint64);
 
 // file.c
 struct file*    filealloc(void);
@@ -60,6 +74,7 @@ int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
+int             readipages(struct inode*, uint, char*, int);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
@@ -72,7 +87,19 @@ void            ramdiskrw(struct buf*);
 // kalloc.c
 void*           kalloc(void);
 void            kfree(void *);
+void*           kalloc_pages(int);
+void            kfree_pages(void *, int);
 void            kinit(void);
+int             freemem_count(void);
+void*           kalloc_zeroed(void);
+int             kzero_refill(void);
+void            kpage_settype(void *, int);
+void            kpage_get(void *);
+void            kpage_put(void *);
+int             kpage_ref(void *);
+void            kpage_counts(long *);
+void            kmemstat(struct memstat *);
+int             kprof_sites(struct kallocsite *, int);
 
 // log.c
 void            initlog(int, struct superblock*);
@@ -81,6 +108,7 @@ void            begin_op(void);
 void            end_op(void);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
@@ -122,19 +150,59 @@ int             setnice(int, int);
 void            meminfo(void);
 void            ps(int);
 int             waitpid(int, int*);
+void            munmap_all(struct proc*);
 int             is_eligible(struct proc*, struct eevdf_data*);
 
 // swtch.S
 void            swtch(struct context*, struct context*);
 
+// swap.c
+void            swapinit(void);
+void            swap_attach(struct superblock*);
+int             swap_alloc(void);
+void            swap_dup(int);
+void            swap_free(int);
+void            swap_lock(void);
+void            swap_unlock(void);
+void            swap_write(int, void *);
+int             swapin(pagetable_t, uint64);
+void            swapstat(struct memstat *);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
+int             holdingany(void);
 void            initlock(struct spinlock*, char*);
 void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
 
+// pagecache.c
+void            pagecacheinit(void);
+void*           pagecache_get(struct inode*, uint);
+void*           pagecache_getlocked(struct inode*, uint);
+int             pagecache_getrange(struct inode*, uint, int, void**);
+void            pagecache_readahead(struct inode*, uint, int);
+void            pagecache_update(struct inode*, uint, void*, uint);
+void            pagecache_drop(struct inode*);
+int             pagecache_reclaim(int);
+void            pagecachestat(struct memstat *);
+
+// reclaim.c
+void            reclaiminit(void);
+int             reclaim(int);
+void            reclaim_check(void);
+void*           kalloc_user(void);
+void            reclaimstat(struct memstat *);
+
+// slab.c
+void            slabinit(void);
+void            kmem_cache_init(struct kmem_cache*, char*, uint, int);
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
+int             slabstat(struct slabstat*, int);
+int             slab_npages(void);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
@@ -147,6 +215,7 @@ void*           memmove(void*, const void*, uint);
 void*           memset(void*, int, uint);
 char*           safestrcpy(char*, const char*, int);
 int             strlen(const char*);
+uint64          strnlen(const char*, uint64);
 int             strncmp(const char*, const char*, uint);
 char*           strncpy(char*, const char*, int);
 
@@ -160,6 +229,7 @@ void            syscall();
 
 // trap.c
 extern uint     ticks;
+extern uint64   nfault;
 void            trapinit(void);
 void            trapinithart(void);
 extern struct spinlock tickslock;
@@ -173,19 +243,34 @@ void            uartputc_sync(int);
 int             uartgetc(void);
 
 // vm.c
+extern void     *zeropage;
 void            kvminit(void);
 void            kvminithart(void);
 void            kvmmap(pagetable_t, uint64, uint64, uint64, int);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
+int             mapmega(pagetable_t, uint64, uint64, int);
 pagetable_t     uvmcreate(void);
 void            uvmfirst(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64, int);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmcopyswap(pagetable_t, uint64, pte_t);
+int             uvmshare(pte_t *, pagetable_t, uint64, uint64);
+int             uvmsplit(pagetable_t, uint64);
+int             uvmprotect(pagetable_t, uint64, uint64, int, int);
+int             uvmmove(pagetable_t, uint64, uint64, uint64);
+int             uvmmapmega(pagetable_t, uint64, uint64, uint64, int, int);
+int             uvmcow(pagetable_t, uint64);
+int             uvmlazy(pagetable_t, uint64);
+int             uvmfault(pagetable_t, uint64, int);
+int             uvmprefault(pagetable_t, uint64, uint64, int);
 void            uvmfree(pagetable_t, uint64);
+void            uvmclearpte(pagetable_t, uint64, int);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
+void            uvmflush(pagetable_t, uint64, uint64);
 pte_t *         walk(pagetable_t, uint64, int);
+pte_t *         walkmega(pagetable_t, uint64);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
@@ -200,6 +285,8 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_rwpage(uint, void *, int);
+void            virtio_disk_rwblocks(uint, void *, uint, int);
 void            virtio_disk_intr(void);
 
 // sysproc.c
@@ -219,6 +306,9 @@ uint64          sys_waitpid(void);
 uint64          sys_mmap(void);
 uint64          sys_munmap(void);
 uint64          sys_freemem(void);
+uint64          sys_slabinfo(void);
+uint64          sys_memstat(void);
+void            mmapinit(void);
 int             sys_munmap_addrlen(uint64 addr, int length);
 
 // number of elements in fixed-size array
@@ -3,9 +3,13 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
 #include "proc.h"
 #include "defs.h"
 #include "elf.h"
+#include "kalloc.h"
 
 static int loadseg(pde_t *, uint64, struct inode *, uint, uint);
 
@@ -26,8 +30,10 @@ exec(char *path, char **argv)
   int i, off;
   uint64 argc, sz = 0, sp, ustack[MAXARG], stackbase;
   struct elfhdr elf;
-  struct inode *ip;
+  struct inode *ip, *prog = 0, *oldprog;
   struct proghdr ph;
+  struct execseg seg[NEXECSEG];
+  int nseg = 0;
   pagetable_t pagetable = 0, oldpagetable;
   struct proc *p = myproc();
 
@@ -49,7 +55,9 @@ exec(char *path, char **argv)
   if((pagetable = proc_pagetable(p)) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Set up the program's segments. Their pages are read in by
+  // execfault() when first touched; only segments beyond the
+  // first NEXECSEG are loaded now.
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -61,6 +69,19 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
+    if(ph.vaddr + ph.memsz > MMAPBASE || ph.off + ph.filesz < ph.off)
+      goto bad;
+    if(nseg < NEXECSEG){
+      seg[nseg].va = ph.vaddr;
+      seg[nseg].memsz = ph.memsz;
+      seg[nseg].filesz = ph.filesz;
+      seg[nseg].off = ph.off;
+      seg[nseg].perm = PTE_R | PTE_U | flags2perm(ph.flags);
+      nseg++;
+      if(ph.vaddr + ph.memsz > sz)
+        sz = ph.vaddr + ph.memsz;
+      continue;
+    }
     uint64 sz1;
     if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz, flags2perm(ph.flags))) == 0)
       goto bad;
@@ -68,8 +89,10 @@ exec(char *path, char **argv)
     if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
       goto bad;
   }
-  iunlockput(ip);
+  // Keep a reference to the file for execfault().
+  iunlock(ip);
   end_op();
+  prog = ip;
   ip = 0;
 
   p = myproc();
@@ -122,11 +145,21 @@ exec(char *path, char **argv)
     
   // Commit to the user image.
   oldpagetable = p->pagetable;
+  oldprog = p->execip;
   p->pagetable = pagetable;
   p->sz = sz;
+  p->execip = prog;
+  memmove(p->seg, seg, sizeof(seg));
+  p->nseg = nseg;
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
+  tlb_flush(p);          // entries for the old page table are stale
   proc_freepagetable(oldpagetable, oldsz);
+  if(oldprog){
+    begin_op();
+    iput(oldprog);
+    end_op();
+  }
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
@@ -137,9 +170,77 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+  if(prog){
+    begin_op();
+    iput(prog);
+    end_op();
+  }
   return -1;
 }
 
+// Read the page at va of one of p's program segments in
+// from the program file and map it, zero-filling the part
+// past the segment's file data. Returns 0 if it did, 1 if
+// va is in no segment, -1 if there is no memory or the file
+// can't be read. May be called with a spinlock held, but
+// then fails for a page in a segment, since reading sleeps;
+// likewise with a sleep-lock held, as by read() and write()
+// copying under an inode lock: locking the program file too
+// could deadlock, or find it is the file already locked.
+// Those callers fault the pages in with uvmprefault() first.
+int
+execfault(struct proc *p, uint64 va)
+{
+  struct execseg *s;
+  uint64 a, n;
+  char *mem;
+
+  va = PGROUNDDOWN(va);
+  for(s = p->seg; s < p->seg + p->nseg; s++)
+    if(va >= s->va && va < s->va + s->memsz)
+      break;
+  if(s == p->seg + p->nseg)
+    return 1;
+  if(holdingany() || p->nsleeplock > 0)
+    return -1;
+  a = va - s->va;
+
+  // A read-only page that is all file data is the same for
+  // every process running the program: share it through the
+  // page cache.
+  if((s->perm & PTE_W) == 0 && a + PGSIZE <= s->filesz && (s->off + a) % PGSIZE == 0){
+    if((mem = pagecache_get(p->execip, s->off + a)) == 0)
+      return -1;
+    if(mappages(p->pagetable, va, PGSIZE, (uint64)mem, s->perm) != 0){
+      kpage_put(mem);
+      return -1;
+    }
+    return 0;
+  }
+
+  if((mem = kalloc_user()) == 0)
+    return -1;
+  // Read-only pages can be dropped and read in again;
+  // writable ones may be written, so they go to swap.
+  kpage_settype(mem, (s->perm & PTE_W) ? PG_ANON : PG_FILE);
+
+  if(a < s->filesz){
+    n = s->filesz - a < PGSIZE ? s->filesz - a : PGSIZE;
+    ilock(p->execip);
+    if(readi(p->execip, 0, (uint64)mem, s->off + a, n) != n){
+      iunlock(p->execip);
+      kfree(mem);
+      return -1;
+    }
+    iunlock(p->execip);
+  }
+  if(mappages(p->pagetable, va, PGSIZE, (uint64)mem, s->perm) != 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
 // Load a program segment into pagetable at virtual address va.
 // va must be page-aligned
 // and the pages from va to va+sz must already be mapped.
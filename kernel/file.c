@@ -12,17 +12,24 @@
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
+#include "memlayout.h"
+#include "kalloc.h"
+#include "slab.h"
 
 struct devsw devsw[NDEV];
 struct {
-  struct spinlock lock;
-  struct file file[NFILE];
+  struct spinlock lock;   // protects f->ref of every open file
 } ftable;
 
+// File structures come from a slab cache, so the number
+// of open files is limited only by memory.
+static struct kmem_cache file_cache;
+
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  kmem_cache_init(&file_cache, "file", sizeof(struct file), PG_KERNEL);
 }
 
 // Allocate a file structure.
@@ -31,16 +38,11 @@ filealloc(void)
 {
   struct file *f;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
-  }
-  release(&ftable.lock);
-  return 0;
+  if((f = kmem_cache_alloc(&file_cache)) == 0)
+    return 0;
+  memset(f, 0, sizeof(*f));
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -72,6 +74,7 @@ fileclose(struct file *f)
   f->ref = 0;
   f->type = FD_NONE;
   release(&ftable.lock);
+  kmem_cache_free(&file_cache, f);
 
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
@@ -118,10 +121,17 @@ fileread(struct file *f, uint64 addr, int n)
       return -1;
     r = devsw[f->major].read(1, addr, n);
   } else if(f->type == FD_INODE){
-    ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
-      f->off += r;
-    iunlock(f->ip);
+    // A program page of the buffer can't be read in under the
+    // inode lock (see execfault()): if the copy fails, fault
+    // the buffer in without it and try once more.
+    for(int again = 0; ; again = 1){
+      ilock(f->ip);
+      if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
+        f->off += r;
+      iunlock(f->ip);
+      if(r >= 0 || again || uvmprefault(myproc()->pagetable, addr, n, 1) < 0)
+        break;
+    }
   } else {
     panic("fileread");
   }
@@ -153,7 +163,7 @@ filewrite(struct file *f, uint64 addr, int n)
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
     int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
-    int i = 0;
+    int i = 0, again = 0;
     while(i < n){
       int n1 = n - i;
       if(n1 > max)
@@ -167,9 +177,16 @@ filewrite(struct file *f, uint64 addr, int n)
       end_op();
 
       if(r != n1){
-        // error from writei
-        break;
+        // error from writei, or a program page of the buffer
+        // that can't be read in under the inode lock (see
+        // execfault()): fault the rest in without it, once
+        if(r < 0 || again || uvmprefault(myproc()->pagetable, addr + i + r, n1 - r, 0) < 0)
+          break;
+        again = 1;
+        i += r;
+        continue;
       }
+      again = 0;
       i += r;
     }
     ret = (i == n ? n : -1);
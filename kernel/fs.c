@@ -20,6 +20,9 @@
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
+#include "memlayout.h"
+#include "kalloc.h"
+#include "slab.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 // there should be one superblock per disk device, but we run with
@@ -44,6 +47,7 @@ fsinit(int dev) {
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
   initlog(dev, &sb);
+  swap_attach(&sb);
 }
 
 // Zero a block.
@@ -172,21 +176,28 @@ bfree(int dev, uint b)
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
+//
+// In-memory inodes are allocated from a slab cache when iget()
+// first needs them and freed when iput() drops the last reference.
+// The table itself is a small hash of the referenced inodes,
+// keyed by (dev, inum), so lookups do not scan every entry.
+
+#define NIHASH 31
 
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *hash[NIHASH];
 } itable;
 
+static struct kmem_cache inode_cache;
+
+#define IHASH(dev, inum) (((dev) * 7 + (inum)) % NIHASH)
+
 void
 iinit()
 {
-  int i = 0;
-  
   initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
-  }
+  kmem_cache_init(&inode_cache, "inode", sizeof(struct inode), PG_KERNEL);
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -246,31 +257,32 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
+  uint h = IHASH(dev, inum);
 
   acquire(&itable.lock);
 
   // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
+  for(ip = itable.hash[h]; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
       ip->ref++;
       release(&itable.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode entry.
-  if(empty == 0)
+  // Allocate a new inode entry.
+  if((ip = kmem_cache_alloc(&inode_cache)) == 0)
     panic("iget: no inodes");
 
-  ip = empty;
+  initsleeplock(&ip->lock, "inode");
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->pages = 0;
+  ip->hnext = itable.hash[h];
+  itable.hash[h] = ip;
   release(&itable.lock);
 
   return ip;
@@ -327,8 +339,8 @@ iunlock(struct inode *ip)
 }
 
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode table entry can
-// be recycled.
+// If that was the last reference, the inode table entry is
+// freed.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -358,6 +370,15 @@ iput(struct inode *ip)
   }
 
   ip->ref--;
+  if(ip->ref == 0){
+    // Last reference: unhash the entry and free it.
+    pagecache_drop(ip);
+    struct inode **pp = &itable.hash[IHASH(ip->dev, ip->inum)];
+    while(*pp != ip)
+      pp = &(*pp)->hnext;
+    *pp = ip->hnext;
+    kmem_cache_free(&inode_cache, ip);
+  }
   release(&itable.lock);
 }
 
@@ -429,6 +450,7 @@ itrunc(struct inode *ip)
   struct buf *bp;
   uint *a;
 
+  pagecache_drop(ip);
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -464,6 +486,46 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Read npages pages of ip's data starting at off, which is
+// page-aligned, into the physically contiguous kernel pages at
+// pa, for the page cache. Bytes past the end of the file read
+// as zero. Blocks the buffer cache holds are copied from it;
+// the rest come straight from the disk, one request for each
+// run of consecutive blocks, so that file data does not push
+// metadata out of the buffer cache.
+// Caller must hold ip->lock.
+// Returns 0, or -1 if a block could not be mapped.
+int
+readipages(struct inode *ip, uint off, char *pa, int npages)
+{
+  uint n, addr, start = 0, len = 0, size;
+
+  size = off < ip->size ? ip->size - off : 0;
+  if(size > npages * PGSIZE)
+    size = npages * PGSIZE;
+  n = (size + BSIZE - 1) / BSIZE;
+  for(uint i = 0; i <= n; i++){
+    addr = 0;
+    if(i < n){
+      if((addr = bmap(ip, off / BSIZE + i)) == 0)
+        return -1;
+      if(bpeek(ip->dev, addr, pa + i * BSIZE))
+        addr = 0;   // may be newer than the disk
+      else if(len > 0 && addr == start + len){
+        len++;
+        continue;
+      }
+    }
+    // the run of blocks to read ends here
+    if(len > 0)
+      virtio_disk_rwblocks(start, pa + (i - len) * BSIZE, len, 0);
+    start = addr;
+    len = addr ? 1 : 0;
+  }
+  memset(pa + size, 0, npages * PGSIZE - size);
+  return 0;
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
@@ -473,6 +535,8 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 {
   uint tot, m;
   struct buf *bp;
+  char *pa;
+  int r;
 
   if(off > ip->size || off + n < off)
     return 0;
@@ -480,6 +544,18 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     n = ip->size - off;
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+    // A file's data comes from the page cache, unless
+    // there is no memory for it
+    if(ip->type == T_FILE && (pa = pagecache_getlocked(ip, PGROUNDDOWN(off))) != 0){
+      m = min(n - tot, PGSIZE - off%PGSIZE);
+      r = either_copyout(user_dst, dst, pa + (off % PGSIZE), m);
+      kpage_put(pa);
+      if(r == -1) {
+        tot = -1;
+        break;
+      }
+      continue;
+    }
     uint addr = bmap(ip, off/BSIZE);
     if(addr == 0)
       break;
@@ -523,8 +599,12 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
       brelse(bp);
       break;
     }
+    pagecache_update(ip, off, bp->data + (off % BSIZE), m);
     log_write(bp);
-    brelse(bp);
+    if(ip->type == T_FILE)
+      bdone(bp);  // file data: recycle it first
+    else
+      brelse(bp);
   }
 
   if(off > ip->size)
@@ -26,6 +26,8 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint swapstart;    // Block number of first swap block
+  uint nswap;        // Number of swap blocks
 };
 
 #define FSMAGIC 0x10203040
@@ -49,6 +51,8 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *hnext; // next inode in the same itable hash bucket
+  struct cpage *pages; // cached pages of its data, see pagecache.c
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
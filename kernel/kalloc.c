@@ -1,6 +1,33 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// and pipe buffers.
+//
+// Memory is managed by a binary buddy allocator: a free
+// block of order k is 2^k physically contiguous pages whose
+// address is aligned to its size. kalloc_pages(k) splits
+// larger blocks as needed and kfree_pages() coalesces a block
+// with its buddy whenever both halves are free.
+//
+// Single pages are the common case, so each hart also keeps
+// its own list of order-0 pages. kalloc()/kfree() only touch
+// that hart-local list; harts refill from and spill to the
+// buddy pool KMEM_BATCH pages at a time, and a hart whose
+// list and the pool are both empty steals a batch from
+// another hart.
+//
+// Idle harts also keep a small pool of pages that are
+// already filled with zeros, so kalloc_zeroed() callers on
+// the page-fault path do not have to clear a page themselves.
+//
+// A kernel built with KALLOC_PROF also keeps a table of
+// kalloc() call sites, counting the pages each one allocated
+// and how many of those came back; see memstat -s.
+//
+// Every physical page has a struct page descriptor holding
+// its reference count and owner type. Each hart counts the
+// pages it moved into and out of each type, so the totals
+// per type (including free pages) are a sum over harts and
+// never need a walk of the free lists.
 
 #include "types.h"
 #include "param.h"
@@ -8,81 +35,605 @@
 #include "spinlock.h"
 #include "riscv.h"
 #include "defs.h"
+#include "kalloc.h"
+#include "memstat.h"
 
 void freerange(void *pa_start, void *pa_end);
 
 extern char end[]; // first address after kernel.
                    // defined by kernel.ld.
 
-struct run {
-  struct run *next;
-};
+struct kmem kmem;
+struct page pages[NPAGES];
 
-struct {
-  struct spinlock lock;
-  struct run *freelist;
-} kmem;
+#ifdef KALLOC_PROF
+// Call-site table, an open-addressed hash keyed by return
+// address. A page remembers its slot in page.site so that
+// kfree() can credit the site that allocated it.
+static struct spinlock kprof_lock;
+static struct kallocsite kprof[NKPROF];
 
-// Track number of free pages
-int freemem_count = 0;
+static void
+kprof_alloc(void *pa, uint64 pc)
+{
+  int i, h;
+
+  acquire(&kprof_lock);
+  h = (pc >> 2) % NKPROF;
+  for(i = 0; i < NKPROF; i++){
+    struct kallocsite *s = &kprof[(h + i) % NKPROF];
+    if(s->pc == 0)
+      s->pc = pc;
+    if(s->pc == pc){
+      s->nalloc++;
+      PA2PAGE(pa)->site = (h + i) % NKPROF + 1;
+      break;
+    }
+  }
+  if(i == NKPROF)
+    PA2PAGE(pa)->site = 0; // table full; not tracked
+  release(&kprof_lock);
+}
+
+static void
+kprof_free(void *pa)
+{
+  struct page *pg = PA2PAGE(pa);
+
+  if(pg->site == 0)
+    return;
+  acquire(&kprof_lock);
+  kprof[pg->site - 1].nfree++;
+  release(&kprof_lock);
+  pg->site = 0;
+}
+
+#define KPROF_ALLOC(pa) kprof_alloc((pa), (uint64)__builtin_return_address(0))
+#define KPROF_FREE(pa)  kprof_free(pa)
+#else
+#define KPROF_ALLOC(pa)
+#define KPROF_FREE(pa)
+#endif
+
+// Move npages pages from type from to type to in this
+// hart's counters.
+static void
+count_type(int from, int to, long npages)
+{
+  push_off();
+  kmem.cpu[cpuid()].ntype[from] -= npages;
+  kmem.cpu[cpuid()].ntype[to] += npages;
+  pop_off();
+}
 
 void
 kinit()
 {
   initlock(&kmem.lock, "kmem");
+  initlock(&kmem.zlock, "kmem_zero");
+#ifdef KALLOC_PROF
+  initlock(&kprof_lock, "kprof");
+#endif
+  for(int k = 0; k <= MAXORDER; k++){
+    kmem.free[k].next = &kmem.free[k];
+    kmem.free[k].prev = &kmem.free[k];
+  }
+  for(int i = 0; i < NCPU; i++)
+    initlock(&kmem.cpu[i].lock, "kmem_cpu");
+
+  // Everything starts out as kernel memory; freerange()
+  // then moves the allocatable pages to PG_FREE.
+  for(int i = 0; i < NPAGES; i++){
+    pages[i].ref = 1;
+    pages[i].type = PG_KERNEL;
+  }
+  kmem.cpu[cpuid()].ntype[PG_KERNEL] = NPAGES;
   freerange(end, (void*)PHYSTOP);
 }
 
+static void
+list_remove(struct run *r)
+{
+  r->prev->next = r->next;
+  r->next->prev = r->prev;
+}
+
+static void
+list_push(struct run *head, struct run *r)
+{
+  r->next = head->next;
+  r->prev = head;
+  head->next->prev = r;
+  head->next = r;
+}
+
+// Return a block of 2^order pages to the buddy pool,
+// merging it with its buddy as long as the buddy is free.
+// Caller must hold kmem.lock.
+static void
+buddy_free(uint64 pa, int order)
+{
+  struct page *pg = PA2PAGE(pa);
+
+  while(order < MAXORDER){
+    uint64 idx = pg - pages;
+    uint64 bidx = idx ^ (1UL << order);
+    if(bidx >= NPAGES)
+      break;
+    struct page *buddy = &pages[bidx];
+    if(!(buddy->flags & PGF_BUDDY) || buddy->order != order)
+      break;
+    list_remove((struct run*)PAGE2PA(buddy));
+    kmem.nfree[order]--;
+    buddy->flags &= ~PGF_BUDDY;
+    if(buddy < pg)
+      pg = buddy;
+    order++;
+  }
+  pg->flags |= PGF_BUDDY;
+  pg->order = order;
+  list_push(&kmem.free[order], (struct run*)PAGE2PA(pg));
+  kmem.nfree[order]++;
+}
+
+// Take a block of 2^order pages out of the buddy pool,
+// splitting a larger block if no block of that order is free.
+// Returns 0 if there is none. Caller must hold kmem.lock.
+static uint64
+buddy_alloc(int order)
+{
+  struct run *r;
+  struct page *pg;
+  int k;
+
+  for(k = order; k <= MAXORDER; k++)
+    if(kmem.free[k].next != &kmem.free[k])
+      break;
+  if(k > MAXORDER)
+    return 0;
+
+  r = kmem.free[k].next;
+  list_remove(r);
+  kmem.nfree[k]--;
+  pg = PA2PAGE(r);
+  pg->flags &= ~PGF_BUDDY;
+
+  // Split, handing the upper halves back to the pool.
+  while(k > order){
+    k--;
+    struct page *upper = pg + (1UL << k);
+    upper->flags |= PGF_BUDDY;
+    upper->order = k;
+    list_push(&kmem.free[k], (struct run*)PAGE2PA(upper));
+    kmem.nfree[k]++;
+  }
+  return (uint64)r;
+}
+
 void
 freerange(void *pa_start, void *pa_end)
 {
   char *p;
+  int n = 0;
+
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-    kfree(p);
+  acquire(&kmem.lock);
+  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE){
+    memset(p, 1, PGSIZE);
+    PA2PAGE(p)->ref = 0;
+    PA2PAGE(p)->type = PG_FREE;
+    buddy_free((uint64)p, 0);
+    n++;
+  }
+  release(&kmem.lock);
+  count_type(PG_KERNEL, PG_FREE, n);
+}
+
+// Detach up to n pages from the front of a hart's list.
+// Returns the detached chain and stores its length in *got.
+static struct run*
+take_batch(struct run **list, int n, int *got)
+{
+  struct run *head, *tail;
+  int i;
+
+  head = *list;
+  if(head == 0){
+    *got = 0;
+    return 0;
+  }
+  tail = head;
+  for(i = 1; i < n && tail->next; i++)
+    tail = tail->next;
+  *list = tail->next;
+  tail->next = 0;
+  *got = i;
+  return head;
+}
+
+// Take a batch of pages from some other hart's free list.
+// Only one kmem_cpu lock is held at a time, so two harts
+// stealing from each other cannot deadlock.
+static struct run*
+steal(int self, int *got)
+{
+  struct run *chain;
+
+  for(int i = 1; i < NCPU; i++){
+    struct kmem_cpu *v = &kmem.cpu[(self + i) % NCPU];
+    acquire(&v->lock);
+    chain = take_batch(&v->freelist, KMEM_BATCH, got);
+    v->nfree -= *got;
+    release(&v->lock);
+    if(chain)
+      return chain;
+  }
+  *got = 0;
+  return 0;
 }
 
 // Free the page of physical memory pointed at by pa,
 // which normally should have been returned by a
 // call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
+// The page must not be shared; see kpage_put().
 void
 kfree(void *pa)
 {
-  struct run *r;
+  struct run *r, *chain;
+  struct kmem_cpu *c;
+  struct page *pg;
+  int n, type;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
+  pg = PA2PAGE(pa);
+  if(pg->type == PG_FREE)
+    panic("kfree: free page");
+  if(pg->ref > 1)
+    panic("kfree: shared page");
+  KPROF_FREE(pa);
 
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
 
+  type = pg->type;
+  pg->ref = 0;
+  pg->type = PG_FREE;
   r = (struct run*)pa;
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  freemem_count++;   // Increment free page count
-  release(&kmem.lock);
+  push_off();
+  c = &kmem.cpu[cpuid()];
+  acquire(&c->lock);
+  r->next = c->freelist;
+  c->freelist = r;
+  c->nfree++;
+  c->ntype[type]--;
+  c->ntype[PG_FREE]++;
+  if(c->nfree > KMEM_HIGH){
+    // Too many cached pages on this hart: give a batch back
+    // to the buddy pool, where they can coalesce again.
+    chain = take_batch(&c->freelist, KMEM_BATCH, &n);
+    c->nfree -= n;
+    acquire(&kmem.lock);
+    while(chain){
+      r = chain;
+      chain = r->next;
+      buddy_free((uint64)r, 0);
+    }
+    release(&kmem.lock);
+  }
+  release(&c->lock);
+  pop_off();
+}
+
+// Take a page off the pre-zeroed pool, or return 0 if it is empty.
+// The page is still accounted as PG_FREE.
+static struct run*
+zpool_get(void)
+{
+  struct run *r;
+
+  acquire(&kmem.zlock);
+  r = kmem.zfree;
+  if(r){
+    kmem.zfree = r->next;
+    kmem.nzero--;
+  }
+  release(&kmem.zlock);
+  if(r)
+    r->next = 0; // the only non-zero word of the page
+  return r;
+}
+
+// Take a page from this hart's list, refilling the list from
+// the buddy pool or another hart as needed, and as a last
+// resort from the pre-zeroed pool. Its contents are undefined.
+static struct run*
+kalloc_page(void)
+{
+  struct run *r, *chain;
+  struct kmem_cpu *c;
+  int id, n;
+
+  push_off();
+  id = cpuid();
+  c = &kmem.cpu[id];
+  acquire(&c->lock);
+  if(c->freelist == 0){
+    // Refill from the buddy pool.
+    acquire(&kmem.lock);
+    for(n = 0; n < KMEM_BATCH; n++){
+      if((r = (struct run*)buddy_alloc(0)) == 0)
+        break;
+      r->next = c->freelist;
+      c->freelist = r;
+    }
+    release(&kmem.lock);
+    c->nfree += n;
+    if(n == 0){
+      // Pool is empty too; steal from another hart.
+      release(&c->lock);
+      chain = steal(id, &n);
+      acquire(&c->lock);
+      if(chain){
+        for(r = chain; r->next; r = r->next)
+          ;
+        r->next = c->freelist;
+        c->freelist = chain;
+        c->nfree += n;
+      }
+    }
+  }
+  r = c->freelist;
+  if(r){
+    c->freelist = r->next;
+    c->nfree--;
+  }
+  release(&c->lock);
+  pop_off();
+
+  if(r == 0 && (r = zpool_get()) == 0)
+    return 0;
+  PA2PAGE(r)->ref = 1;
+  PA2PAGE(r)->type = PG_KERNEL;
+  count_type(PG_FREE, PG_KERNEL, 1);
+  return r;
 }
 
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
+// The page starts out as PG_KERNEL with one reference.
 void *
 kalloc(void)
 {
   struct run *r;
 
+  if((r = kalloc_page()) != 0){
+    memset((char*)r, 5, PGSIZE); // fill with junk
+    KPROF_ALLOC(r);
+  }
+  return (void*)r;
+}
+
+// Like kalloc(), but the page is filled with zeros.
+// Takes an already-zeroed page from the pool that idle
+// harts keep filled, and zeroes one on the spot only
+// when the pool is empty.
+void *
+kalloc_zeroed(void)
+{
+  struct run *r;
+
+  if((r = zpool_get()) != 0){
+    PA2PAGE(r)->ref = 1;
+    PA2PAGE(r)->type = PG_KERNEL;
+    count_type(PG_FREE, PG_KERNEL, 1);
+    __sync_fetch_and_add(&kmem.zhit, 1);
+    KPROF_ALLOC(r);
+    return (void*)r;
+  }
+  if((r = kalloc_page()) != 0){
+    memset((char*)r, 0, PGSIZE);
+    KPROF_ALLOC(r);
+  }
+  __sync_fetch_and_add(&kmem.zmiss, 1);
+  return (void*)r;
+}
+
+// Zero one free page and add it to the pre-zeroed pool.
+// Called by idle harts from the scheduler. Returns 1 if
+// it zeroed a page, 0 if the pool is full or memory is short.
+int
+kzero_refill(void)
+{
+  struct run *r;
+
+  // Leave some pages on the ordinary lists so a burst of
+  // kalloc() calls does not drain the pool right away.
+  if(kmem.nzero >= KMEM_ZPOOL || freemem_count() < 2*KMEM_ZPOOL)
+    return 0;
+  if((r = kalloc_page()) == 0)
+    return 0;
+  memset((char*)r, 0, PGSIZE);
+  PA2PAGE(r)->ref = 0;
+  PA2PAGE(r)->type = PG_FREE;
+  count_type(PG_KERNEL, PG_FREE, 1);
+
+  acquire(&kmem.zlock);
+  r->next = kmem.zfree;
+  kmem.zfree = r;
+  kmem.nzero++;
+  release(&kmem.zlock);
+  return 1;
+}
+
+// Allocate 2^order physically contiguous pages, aligned
+// to their size. Order 0 is the same as kalloc().
+// Returns 0 if no such block is free.
+void *
+kalloc_pages(int order)
+{
+  uint64 pa;
+
+  if(order < 0 || order > MAXORDER)
+    return 0;
+  if(order == 0)
+    return kalloc();
+
   acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  if (r)
-    freemem_count--;  // Decrement free page count
+  pa = buddy_alloc(order);
   release(&kmem.lock);
+  if(pa == 0)
+    return 0;
 
-  if(r)
-    memset((char*)r, 5, PGSIZE); // fill with junk
-  return (void*)r;
-}
\ No newline at end of file
+  for(int i = 0; i < (1 << order); i++){
+    PA2PAGE(pa)[i].ref = 1;
+    PA2PAGE(pa)[i].type = PG_KERNEL;
+  }
+  count_type(PG_FREE, PG_KERNEL, 1L << order);
+
+  memset((char*)pa, 5, PGSIZE << order); // fill with junk
+  KPROF_ALLOC((void*)pa);
+  return (void*)pa;
+}
+
+// Free a block returned by kalloc_pages(order).
+void
+kfree_pages(void *pa, int order)
+{
+  struct page *pg;
+
+  if(order == 0){
+    kfree(pa);
+    return;
+  }
+  if(order < 0 || order > MAXORDER ||
+     ((uint64)pa - KERNBASE) % (PGSIZE << order) != 0 ||
+     (char*)pa < end || (uint64)pa + (PGSIZE << order) > PHYSTOP)
+    panic("kfree_pages");
+
+  // Fill with junk to catch dangling refs.
+  memset(pa, 1, PGSIZE << order);
+
+  KPROF_FREE(pa);
+  pg = PA2PAGE(pa);
+  for(int i = 0; i < (1 << order); i++){
+    if(pg[i].type == PG_FREE || pg[i].ref > 1)
+      panic("kfree_pages: page in use");
+    count_type(pg[i].type, PG_FREE, 1);
+    pg[i].ref = 0;
+    pg[i].type = PG_FREE;
+  }
+
+  acquire(&kmem.lock);
+  buddy_free((uint64)pa, order);
+  release(&kmem.lock);
+}
+
+// Record that the allocated page at pa is now used as type.
+void
+kpage_settype(void *pa, int type)
+{
+  struct page *pg = PA2PAGE(pa);
+
+  if(type == PG_FREE || type >= NPGTYPE || pg->type == PG_FREE)
+    panic("kpage_settype");
+  count_type(pg->type, type, 1);
+  pg->type = type;
+}
+
+// Take another reference to the allocated page at pa.
+void
+kpage_get(void *pa)
+{
+  struct page *pg = PA2PAGE(pa);
+
+  if(pg->type == PG_FREE)
+    panic("kpage_get");
+  __sync_fetch_and_add(&pg->ref, 1);
+}
+
+// Drop a reference to the page at pa, freeing
+// the page when the last reference goes away.
+void
+kpage_put(void *pa)
+{
+  struct page *pg = PA2PAGE(pa);
+
+  if(pg->ref < 1)
+    panic("kpage_put");
+  if(__sync_sub_and_fetch(&pg->ref, 1) == 0){
+    pg->ref = 1;
+    kfree(pa);
+  }
+}
+
+// Number of references to the page at pa.
+int
+kpage_ref(void *pa)
+{
+  return PA2PAGE(pa)->ref;
+}
+
+// Fill counts[0..NPGTYPE-1] with the number of pages of each type.
+void
+kpage_counts(long *counts)
+{
+  for(int t = 0; t < NPGTYPE; t++){
+    counts[t] = 0;
+    for(int i = 0; i < NCPU; i++)
+      counts[t] += kmem.cpu[i].ntype[t];
+  }
+}
+
+// Number of free pages, summed over the harts' counters.
+// Moving pages between free lists does not change any
+// counter, so no lock is needed.
+int
+freemem_count(void)
+{
+  long n = 0;
+
+  for(int i = 0; i < NCPU; i++)
+    n += kmem.cpu[i].ntype[PG_FREE];
+  return (int)n;
+}
+
+// Fill in the page counts of a struct memstat.
+// The slab field is left to the caller.
+void
+kmemstat(struct memstat *ms)
+{
+  long counts[NPGTYPE];
+
+  kpage_counts(counts);
+  ms->total = NPAGES;
+  ms->free = counts[PG_FREE];
+  ms->zeroed = kmem.nzero;
+  ms->kernel = counts[PG_KERNEL];
+  ms->anon = counts[PG_ANON];
+  ms->file = counts[PG_FILE];
+  ms->pgtbl = counts[PG_PGTBL];
+  ms->kstack = counts[PG_KSTACK];
+  ms->pipe = counts[PG_PIPE];
+}
+
+// Copy up to max entries of the kalloc() call-site table
+// to sites. Returns the number copied, which is always 0
+// unless the kernel was built with KALLOC_PROF.
+int
+kprof_sites(struct kallocsite *sites, int max)
+{
+  int n = 0;
+
+#ifdef KALLOC_PROF
+  acquire(&kprof_lock);
+  for(int i = 0; i < NKPROF && n < max; i++)
+    if(kprof[i].pc)
+      sites[n++] = kprof[i];
+  release(&kprof_lock);
+#endif
+  return n;
+}
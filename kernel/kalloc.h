@@ -3,12 +3,76 @@
 void kinit(void);
 void* kalloc(void);
 void kfree(void*);
+void* kalloc_pages(int);
+void kfree_pages(void*, int);
+int freemem_count(void);
+void* kalloc_zeroed(void);
+int kzero_refill(void);
+
+#define KMEM_BATCH 32               // pages moved between a hart and the buddy pool at once
+#define KMEM_HIGH  (4*KMEM_BATCH)   // a hart spills a batch once it holds more than this
+#define MAXORDER   10               // largest buddy block is 2^MAXORDER pages (4MB)
+#define MEGAORDER  9                // a 2MB block, for a megapage mapping
+#define KMEM_ZPOOL 64               // pre-zeroed pages kept by idle harts
+#define NKPROF     64               // kalloc() call sites tracked with KALLOC_PROF
+#define KMEM_LOW   64               // reclaim when fewer pages than this are free
+#define RECLAIM_BATCH 16            // pages reclaim() frees when an allocation fails
+
+// Owner types of physical pages
+#define PG_FREE    0   // on a hart's free list or in the buddy pool
+#define PG_KERNEL  1   // kernel image, trapframes, slabs, other kernel data
+#define PG_ANON    2   // anonymous user memory (heap, stack, anon mmap)
+#define PG_FILE    3   // user memory backed by a file
+#define PG_PGTBL   4   // page-table page
+#define PG_KSTACK  5   // kernel stack
+#define PG_PIPE    6   // pipe buffers
+#define NPGTYPE    7
+
+// Page flags
+#define PGF_BUDDY  0x1 // heads a free block in the buddy pool
+
+// Physical page descriptor, one for every page from KERNBASE to PHYSTOP.
+struct page {
+  int ref;        // references to the page (mappings, caches, ...)
+  uchar type;     // PG_* owner type
+  uchar flags;    // PGF_* flags
+  uchar order;    // block order, if PGF_BUDDY
+  ushort nlive;   // valid or swapped PTEs in it, if PG_PGTBL
+#ifdef KALLOC_PROF
+  ushort site;    // kalloc() call-site slot + 1, or 0
+#endif
+};
+
+#define NPAGES      ((PHYSTOP - KERNBASE) / PGSIZE)
+#define PA2PAGE(pa) (&pages[((uint64)(pa) - KERNBASE) / PGSIZE])
+#define PAGE2PA(pg) (KERNBASE + (uint64)((pg) - pages) * PGSIZE)
+
+extern struct page pages[NPAGES];
 
 struct run {
-  struct run *next; 
+  struct run *next;
+  struct run *prev;     // buddy free lists only
 }; // struct run is a linked list of free memory
 
-extern struct {
-  struct spinlock lock; // lock for the allocator
-  struct run *freelist; // pointer to the free list
-} kmem; // kmem is the memory allocator
+// Per-hart free list. Only the owning hart allocates from it,
+// but other harts may steal from it when they run dry.
+struct kmem_cpu {
+  struct spinlock lock; // protects freelist and nfree
+  struct run *freelist; // pages cached by this hart
+  int nfree;            // number of pages on freelist
+  long ntype[NPGTYPE];  // pages this hart moved into minus out of each type
+};
+
+struct kmem {
+  struct spinlock lock;              // lock for the buddy pool
+  struct run free[MAXORDER+1];       // circular free list of blocks per order
+  int nfree[MAXORDER+1];             // number of free blocks per order
+  struct kmem_cpu cpu[NCPU];         // per-hart free lists of single pages
+  struct spinlock zlock;             // lock for the pre-zeroed pool
+  struct run *zfree;                 // pages already filled with zeros
+  int nzero;                         // number of pages on zfree
+  uint64 zhit;                       // kalloc_zeroed() served from zfree
+  uint64 zmiss;                      // kalloc_zeroed() that had to zero a page
+}; // kmem is the memory allocator
+
+extern struct kmem kmem;
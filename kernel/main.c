@@ -17,6 +17,7 @@ main()
     printf("xv6 kernel is booting\n");
     printf("\n");
     kinit();         // physical page allocator
+    slabinit();      // kernel object caches
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
     procinit();      // process table
@@ -26,7 +27,12 @@ main()
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
     iinit();         // inode table
+    pagecacheinit(); // shared file pages
     fileinit();      // file table
+    pipeinit();      // pipe buffers
+    mmapinit();      // mmap area records
+    reclaiminit();   // page reclaim
+    swapinit();      // swap slots
     virtio_disk_init(); // emulated hard disk
     userinit();      // first user process
     __sync_synchronize();
@@ -0,0 +1,55 @@
+#ifndef _MEMSTAT_H_
+#define _MEMSTAT_H_
+
+// Statistics exported to user space.
+// Both the kernel and user programs use this header file.
+
+// One kernel object cache, as reported by slabinfo().
+struct slabstat {
+  char name[16];   // cache name
+  uint objsize;    // bytes per object
+  uint perslab;    // objects per slab page
+  uint nslabs;     // pages owned by the cache
+  uint active;     // objects currently allocated
+  uint64 nalloc;   // total allocations
+  uint64 nhit;     // allocations served from a per-hart magazine
+};
+
+// Physical memory by use, as reported by memstat(). In pages.
+struct memstat {
+  uint64 total;    // pages from KERNBASE to PHYSTOP
+  uint64 free;     // free pages, including zeroed
+  uint64 zeroed;   // free pages already filled with zeros
+  uint64 kernel;   // kernel image and other kernel data
+  uint64 slab;     // pages held by object caches (part of kernel and pipe)
+  uint64 anon;     // anonymous user memory
+  uint64 file;     // file-backed user memory
+  uint64 pgtbl;    // page-table pages
+  uint64 kstack;   // kernel stacks
+  uint64 pipe;     // pipe buffers
+  uint64 nscan;       // pages examined by reclaim
+  uint64 nreclaim;    // pages reclaim evicted
+  uint64 nreclaimrun; // times reclaim ran
+  uint64 swaptotal;   // swap slots (pages)
+  uint64 swapused;    // swap slots in use
+  uint64 nswapin;     // pages read from swap
+  uint64 nswapout;    // pages written to swap
+  uint64 nfault;      // user page faults
+  uint64 asids;       // ASIDs per hart, 0 if the MMU has none
+  uint64 nasidroll;   // times a hart ran out of ASIDs
+  uint64 pcache;      // pages in the page cache (part of file)
+  uint64 pcsaved;     // copies of cached pages not made, one per extra mapping
+  uint64 pchit;       // page-cache lookups that found the page
+  uint64 pcmiss;      // page-cache lookups that read the file
+  uint64 zeromap;     // PTEs mapping the shared zero page
+};
+
+// One kalloc() call site, as reported by memstat() when the
+// kernel is built with KALLOC_PROF.
+struct kallocsite {
+  uint64 pc;       // return address of the call
+  uint64 nalloc;   // allocations made there
+  uint64 nfree;    // of those, how many were freed again
+};
+
+#endif // _MEMSTAT_H_
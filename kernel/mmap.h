@@ -3,6 +3,7 @@
 
 #include "types.h"
 #include "param.h"
+#include "spinlock.h"
 
 // Forward declaration of proc structure
 struct proc;
@@ -16,11 +17,26 @@ struct mmap_area {
   int offset;        // file offset (page-aligned)
   int prot;          // PROT_READ, PROT_WRITE
   int flags;         // MAP_ANONYMOUS, MAP_POPULATE
-  struct proc *p;    // owning process
-  int used;          // slot in use
+  int around;        // pages a read fault maps, 1 for just the one
+  struct mmap_area *left;  // areas at lower addresses
+  struct mmap_area *right; // areas at higher addresses
+  int height;        // height of the subtree rooted here
 };
 
-// Global mmap areas array
-extern struct mmap_area mmap_areas[MAX_MMAP_AREA];
+// Each process's areas form an AVL tree ordered by address,
+// rooted at p->mmaps. The areas never overlap, so the tree
+// also finds the area containing an address in O(log n).
+// Areas are allocated from a slab cache; mmap_lock protects
+// every process's tree.
+extern struct spinlock mmap_lock;
 
-#endif // _MMAP_H_ 
\ No newline at end of file
+struct mmap_area* mmap_alloc(void);
+int               mmap_insert(struct proc*, struct mmap_area*, int);
+void              mmap_remove(struct proc*, struct mmap_area*);
+struct mmap_area* mmap_find(struct proc*, uint64);
+struct mmap_area* mmap_first(struct proc*);
+struct mmap_area* mmap_next(struct proc*, struct mmap_area*);
+int               mmap_writeback(struct proc*, struct mmap_area*, uint64, uint64);
+int               mmap_splitrange(struct proc*, uint64, uint64);
+
+#endif // _MMAP_H_
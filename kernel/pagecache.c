@@ -0,0 +1,317 @@
+// Page cache.
+//
+// Whole pages of file data kept in memory. readi() reads a
+// file through them, and processes map them directly: the text
+// of a program many processes run, a MAP_SHARED file mapping,
+// and private file mappings until they write (copy-on-write).
+// So a file that is read and mapped by many processes is in
+// memory once; the buffer cache holds file data only briefly.
+// Each inode has a list of its cached pages, keyed by
+// page-aligned file offset. The cache holds one reference to
+// each page, and each PTE that maps it another.
+//
+// writei() copies what it writes into any cached page as well,
+// so the pages stay the same as the file. A page leaves the
+// cache when the last reference to its inode goes away, when
+// the file is truncated (processes that map the page keep the
+// old data), or when reclaim needs memory and no process maps
+// the page.
+//
+// Pages are filled and updated with the inode locked, so a page
+// is never added with data older than a write.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "defs.h"
+#include "kalloc.h"
+#include "slab.h"
+#include "memstat.h"
+
+struct cpage {
+  struct inode *ip;      // file the page belongs to
+  uint off;              // file offset, page-aligned
+  void *pa;              // the page
+  struct cpage *inext;   // next page of the same inode
+  struct cpage *next;    // all pages, least recently used first
+  struct cpage *prev;
+};
+
+struct {
+  struct spinlock lock;  // protects everything here and ip->pages
+  struct cpage lru;      // circular list of all pages
+  int npages;            // pages in the cache
+  uint64 nhit;           // lookups served from the cache
+  uint64 nmiss;          // lookups that read the file
+} pcache;
+
+static struct kmem_cache cpage_cache;
+
+void
+pagecacheinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+  pcache.lru.next = pcache.lru.prev = &pcache.lru;
+  kmem_cache_init(&cpage_cache, "cpage", sizeof(struct cpage), PG_KERNEL);
+}
+
+// Find ip's page at off. Caller must hold pcache.lock.
+static struct cpage*
+lookup(struct inode *ip, uint off)
+{
+  struct cpage *cp;
+
+  for(cp = ip->pages; cp; cp = cp->inext)
+    if(cp->off == off)
+      return cp;
+  return 0;
+}
+
+// Take cp off both lists and free it with the cache's
+// reference to its page. Caller must hold pcache.lock.
+static void
+evict(struct cpage *cp)
+{
+  struct cpage **pp;
+
+  for(pp = &cp->ip->pages; *pp != cp; pp = &(*pp)->inext)
+    ;
+  *pp = cp->inext;
+  cp->prev->next = cp->next;
+  cp->next->prev = cp->prev;
+  pcache.npages--;
+  kpage_put(cp->pa);
+  kmem_cache_free(&cpage_cache, cp);
+}
+
+// Return ip's cached page at off with a reference taken for
+// the caller, now the most recently used; or 0 if it is not
+// cached.
+static void*
+hit(struct inode *ip, uint off)
+{
+  struct cpage *cp;
+
+  acquire(&pcache.lock);
+  if((cp = lookup(ip, off)) == 0){
+    release(&pcache.lock);
+    return 0;
+  }
+  kpage_get(cp->pa);
+  cp->prev->next = cp->next;
+  cp->next->prev = cp->prev;
+  cp->prev = pcache.lru.prev;
+  cp->next = &pcache.lru;
+  cp->prev->next = cp;
+  pcache.lru.prev = cp;
+  pcache.nhit++;
+  release(&pcache.lock);
+  return cp->pa;
+}
+
+// Add the page pa, which the caller has a reference to, to
+// the cache as ip's page at off. Returns 0, or -1 if there is
+// no memory to track it.
+static int
+add(struct inode *ip, uint off, void *pa)
+{
+  struct cpage *cp;
+
+  if((cp = kmem_cache_alloc(&cpage_cache)) == 0)
+    return -1;
+  acquire(&pcache.lock);
+  pcache.nmiss++;
+  cp->ip = ip;
+  cp->off = off;
+  cp->pa = pa;
+  cp->inext = ip->pages;
+  ip->pages = cp;
+  cp->prev = pcache.lru.prev;
+  cp->next = &pcache.lru;
+  cp->prev->next = cp;
+  pcache.lru.prev = cp;
+  pcache.npages++;
+  kpage_get(pa);   // the cache's reference
+  release(&pcache.lock);
+  return 0;
+}
+
+// Put n consecutive pages of ip's data, from off on, in
+// pages[], each with a reference taken for the caller. off must
+// be page-aligned. Every caller gets the same pages. Bytes past
+// the end of the file read as zero.
+// Pages that are not cached yet are read a run at a time, into
+// physically contiguous pages when a block of them is free, so
+// that readipages() can read consecutive disk blocks with one
+// request.
+// Returns the number of pages, from the first, put in pages[]:
+// fewer than n if there is no memory or the file can't be read.
+// Caller must hold ip's lock, and no spinlock unless it is
+// content with pages that are free already.
+int
+pagecache_getrange(struct inode *ip, uint off, int n, void **pages)
+{
+  int got, k, order, j;
+  char *pa;
+
+  for(got = 0; got < n; got += k){
+    k = 1;
+    if((pages[got] = hit(ip, off + got * PGSIZE)) != 0)
+      continue;
+
+    // The run of pages not cached, and the largest
+    // power-of-two block of pages in it that is free.
+    // No one else can add pages meanwhile: that takes ip's lock.
+    acquire(&pcache.lock);
+    while(got + k < n && k < (1 << PCBATCHORDER) && lookup(ip, off + (got + k) * PGSIZE) == 0)
+      k++;
+    release(&pcache.lock);
+    for(order = 0; (2 << order) <= k; order++)
+      ;
+    if(!holdingany())
+      reclaim_check();
+    pa = 0;
+    while(order > 0 && (pa = kalloc_pages(order)) == 0)
+      order--;
+    if(pa == 0 && (pa = holdingany() ? kalloc_zeroed() : kalloc_user()) == 0)
+      break;
+    k = 1 << order;
+
+    if(readipages(ip, off + got * PGSIZE, pa, k) < 0){
+      for(j = 0; j < k; j++)
+        kfree(pa + j * PGSIZE);
+      break;
+    }
+    for(j = 0; j < k; j++){
+      kpage_settype(pa + j * PGSIZE, PG_FILE);
+      if(add(ip, off + (got + j) * PGSIZE, pa + j * PGSIZE) < 0)
+        break;
+      pages[got + j] = pa + j * PGSIZE;
+    }
+    if(j < k){
+      for(int i = j; i < k; i++)
+        kfree(pa + i * PGSIZE);
+      return got + j;
+    }
+  }
+  return got;
+}
+
+// Return the page of ip's data at off, which must be
+// page-aligned, with a reference taken for the caller, as
+// pagecache_getrange() does. Returns 0 if there is no memory or
+// the file can't be read.
+// Caller must hold ip's lock, and no spinlock unless it is
+// content with pages that are free already.
+void*
+pagecache_getlocked(struct inode *ip, uint off)
+{
+  void *pa;
+
+  if(pagecache_getrange(ip, off, 1, &pa) != 1)
+    return 0;
+  return pa;
+}
+
+// Read n pages of ip's data from off on into the cache, if they
+// are not there yet, without keeping references to them.
+// Caller must hold ip's lock, and no spinlock.
+void
+pagecache_readahead(struct inode *ip, uint off, int n)
+{
+  void *pages[1 << PCBATCHORDER];
+  int k, got;
+
+  for(; n > 0; n -= k, off += k * PGSIZE){
+    k = n < NELEM(pages) ? n : NELEM(pages);
+    got = pagecache_getrange(ip, off, k, pages);
+    for(int i = 0; i < got; i++)
+      kpage_put(pages[i]);
+    if(got < k)
+      break;
+  }
+}
+
+// pagecache_getlocked() for a caller that does not hold
+// ip's lock, nor any spinlock.
+void*
+pagecache_get(struct inode *ip, uint off)
+{
+  void *pa;
+
+  ilock(ip);
+  pa = pagecache_getlocked(ip, off);
+  iunlock(ip);
+  return pa;
+}
+
+// Copy n bytes that writei() wrote at off into ip's cached
+// page, if there is one. They must not cross a page boundary.
+// Caller must hold ip's lock.
+void
+pagecache_update(struct inode *ip, uint off, void *src, uint n)
+{
+  struct cpage *cp;
+
+  if(ip->pages == 0)
+    return;
+  acquire(&pcache.lock);
+  if((cp = lookup(ip, PGROUNDDOWN(off))) != 0)
+    memmove((char*)cp->pa + off % PGSIZE, src, n);
+  release(&pcache.lock);
+}
+
+// Drop all of ip's cached pages. Pages still mapped stay
+// with the processes that map them.
+// Caller must hold ip's lock, or the last reference to ip.
+void
+pagecache_drop(struct inode *ip)
+{
+  if(ip->pages == 0)
+    return;
+  acquire(&pcache.lock);
+  while(ip->pages)
+    evict(ip->pages);
+  release(&pcache.lock);
+}
+
+// Free up to target cached pages that no process maps,
+// least recently used first. Returns the number freed.
+int
+pagecache_reclaim(int target)
+{
+  struct cpage *cp, *next;
+  int n = 0;
+
+  acquire(&pcache.lock);
+  for(cp = pcache.lru.next; cp != &pcache.lru && n < target; cp = next){
+    next = cp->next;
+    if(kpage_ref(cp->pa) == 1){
+      evict(cp);
+      n++;
+    }
+  }
+  release(&pcache.lock);
+  return n;
+}
+
+void
+pagecachestat(struct memstat *ms)
+{
+  struct cpage *cp;
+  int ref;
+
+  acquire(&pcache.lock);
+  ms->pcache = pcache.npages;
+  ms->pcsaved = 0;
+  for(cp = pcache.lru.next; cp != &pcache.lru; cp = cp->next)
+    if((ref = kpage_ref(cp->pa)) > 2)
+      ms->pcsaved += ref - 2;  // one copy serves every mapping
+  ms->pchit = pcache.nhit;
+  ms->pcmiss = pcache.nmiss;
+  release(&pcache.lock);
+}
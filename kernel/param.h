@@ -1,8 +1,7 @@
 #define NPROC        64  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE       50  // i-nodes usertests' iref test cycles through
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
@@ -12,10 +11,22 @@
 #define FSSIZE       2000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
 #define USERSTACK    1     // user stack pages
+#define NEXECSEG     4     // program segments exec() loads on demand
+#define FAULTAROUND  16    // pages a read fault on an mmap area maps
+#define FAULTAROUND_SEQ 64 // the same, after MADV_SEQUENTIAL
+#define PCBATCHORDER 4     // page cache reads up to 2^n pages at once
+#define NPOPULATE    32    // pages MAP_POPULATE maps per batch
+#define NSWAPSLOT    16384 // swap slots (pages) mkfs reserves after the file system
+#define SWAPSIZE     (NSWAPSLOT*4) // size of swap area in blocks
 
 #define PROT_READ     0x1     // read permission
 #define PROT_WRITE    0x2     // write permission
 #define MAP_ANONYMOUS 0x1     // anonymous mapping
 #define MAP_POPULATE  0x2     // pre-populate pages
-#define MAX_MMAP_AREA 64      // max number of mappings
+#define MAP_SHARED    0x4     // stores reach the file or forked children
+#define MADV_NORMAL     0     // fault around as usual
+#define MADV_RANDOM     1     // fault in one page at a time
+#define MADV_SEQUENTIAL 2     // fault in many pages ahead
+#define MADV_WILLNEED   3     // read the pages in now
+#define MADV_DONTNEED   4     // drop the pages, keep the mapping
 #define MMAPBASE      0x40000000ULL  // base of mmap region
\ No newline at end of file
@@ -7,6 +7,9 @@
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "memlayout.h"
+#include "kalloc.h"
+#include "slab.h"
 
 #define PIPESIZE 512
 
@@ -19,6 +22,14 @@ struct pipe {
   int writeopen;  // write fd is still open
 };
 
+static struct kmem_cache pipe_cache;
+
+void
+pipeinit(void)
+{
+  kmem_cache_init(&pipe_cache, "pipe", sizeof(struct pipe), PG_PIPE);
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -28,7 +39,7 @@ pipealloc(struct file **f0, struct file **f1)
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((pi = (struct pipe*)kalloc()) == 0)
+  if((pi = (struct pipe*)kmem_cache_alloc(&pipe_cache)) == 0)
     goto bad;
   pi->readopen = 1;
   pi->writeopen = 1;
@@ -47,7 +58,7 @@ pipealloc(struct file **f0, struct file **f1)
 
  bad:
   if(pi)
-    kfree((char*)pi);
+    kmem_cache_free(&pipe_cache, pi);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -68,7 +79,7 @@ pipeclose(struct pipe *pi, int writable)
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    kfree((char*)pi);
+    kmem_cache_free(&pipe_cache, pi);
   } else
     release(&pi->lock);
 }
@@ -90,8 +101,15 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
       sleep(&pi->nwrite, &pi->lock);
     } else {
       char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
-        break;
+      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1){
+        // The page may have been swapped out while we slept;
+        // bring it back without holding the pipe lock.
+        release(&pi->lock);
+        if(uvmfault(pr->pagetable, addr + i, 0) < 0)
+          return i;
+        acquire(&pi->lock);
+        continue;
+      }
       pi->data[pi->nwrite++ % PIPESIZE] = ch;
       i++;
     }
@@ -120,9 +138,18 @@ piperead(struct pipe *pi, uint64 addr, int n)
   for(i = 0; i < n; i++){  //DOC: piperead-copy
     if(pi->nread == pi->nwrite)
       break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
-      break;
+    ch = pi->data[pi->nread % PIPESIZE];
+    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1){
+      // Swapped out while we slept, or copy-on-write with no
+      // free page at hand? Fix it up without the lock.
+      release(&pi->lock);
+      if(uvmfault(pr->pagetable, addr + i, 1) < 0)
+        return i;
+      acquire(&pi->lock);
+      i--;
+      continue;
+    }
+    pi->nread++;
   }
   wakeup(&pi->nwrite);  //DOC: piperead-wakeup
   release(&pi->lock);
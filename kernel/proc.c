@@ -7,7 +7,8 @@
 #include "defs.h"
 #include "elf.h"
 #include "kalloc.h" // Used when printing memory info
-#include "mmap.h"   // For mmap_areas
+#include "mmap.h"   // For mmap areas
+#include "memstat.h"
 
 struct cpu cpus[NCPU];
 
@@ -55,9 +56,6 @@ static int nice_to_weight[40] = {
     15      // nice = 39
 };
 
-// Global mmap areas array
-extern struct mmap_area mmap_areas[MAX_MMAP_AREA];
-
 static char *states[] = {
   [UNUSED]    "unused",
   [USED]      "used",
@@ -97,6 +95,7 @@ proc_mapstacks(pagetable_t kpgtbl)
     char *pa = kalloc();
     if(pa == 0)
       panic("kalloc");
+    kpage_settype(pa, PG_KSTACK);
     uint64 va = KSTACK((int) (p - proc));
     kvmmap(kpgtbl, va, (uint64)pa, PGSIZE, PTE_R | PTE_W);
   }
@@ -230,6 +229,7 @@ freeproc(struct proc *p)
   if(p->pagetable)
     proc_freepagetable(p->pagetable, p->sz);
   p->pagetable = 0;
+  memset(p->asid, 0, sizeof(p->asid));  // its ASIDs' TLB entries are stale
   p->sz = 0;
   p->pid = 0;
   p->parent = 0;
@@ -323,6 +323,27 @@ userinit(void)
   release(&p->lock);
 }
 
+// Cut p's program segments off at sz, after sbrk() shrank the
+// process, so that growing it again gives zeroed pages rather
+// than reading the program file in.
+static void
+trimsegs(struct proc *p, uint64 sz)
+{
+  int i, n = 0;
+
+  for(i = 0; i < p->nseg; i++){
+    struct execseg *s = &p->seg[i];
+    if(s->va >= sz)
+      continue;   // wholly gone
+    if(s->va + s->memsz > sz)
+      s->memsz = sz - s->va;
+    if(s->filesz > s->memsz)
+      s->filesz = s->memsz;
+    p->seg[n++] = *s;
+  }
+  p->nseg = n;
+}
+
 // Grow or shrink user memory by n bytes.
 // Return 0 on success, -1 on failure.
 int
@@ -333,58 +354,115 @@ growproc(int n)
 
   sz = p->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
+    // Pages are allocated by uvmlazy() on first touch.
+    // The heap must stay below the mmap region.
+    if(sz + n > MMAPBASE)
       return -1;
-    }
+    sz += n;
   } else if(n < 0){
     sz = uvmdealloc(p->pagetable, sz, sz + n);
+    trimsegs(p, sz);
   }
   p->sz = sz;
   return 0;
 }
 
-// Copy parent's mmap areas to child
-static void
-copy_mmap_areas(struct proc *parent, struct proc *child)
+// Give every untouched page of p's shared anonymous memory a
+// zeroed page, so that a child forked next maps the same pages
+// as p instead of faulting in copies of its own. Reclaim leaves
+// these pages alone, so they stay until the child has them.
+// Must be called without a spinlock held; kalloc_user() may
+// reclaim. Returns -1 if out of memory.
+static int
+fill_shared(struct proc *p)
 {
-  for(int i = 0; i < MAX_MMAP_AREA; i++) {
-    // Select the mmap area that is used and the parent process
-    if(mmap_areas[i].used && mmap_areas[i].p == parent) { 
-      // Find free slot for the child process
-      for(int j = 0; j < MAX_MMAP_AREA; j++) {
-        if(!mmap_areas[j].used) {
-          // Copy the mmap area to the child process
-          mmap_areas[j] = mmap_areas[i];
-          mmap_areas[j].p = child;
-
-          // Copy the virtual address range of the mmap area
-          uint64 start = mmap_areas[i].addr;
-          uint64 end = start + mmap_areas[i].length;
+  struct mmap_area *ma;
+  pte_t *pte;
+  char *mem;
+  int perm, n = 0;
 
-  
-          for(uint64 addr = start; addr < end; addr += PGSIZE) {
-            // Get the page table entry of the parent process
-            pte_t *pte = walk(parent->pagetable, addr, 0);
-            // If the page table entry is valid
-            if(pte && (*pte & PTE_V)) {
-              // Get the physical address of the parent process
-              uint64 pa = PTE2PA(*pte);
-              // Allocate a new page for the child process
-              char *mem = kalloc();
-              if(mem == 0)
-                panic("copy_mmap_area: kalloc failed");
-              // Copy the page content from the parent process to the new page
-              memmove(mem, (char*)pa, PGSIZE);
-              // Map the new page to the child process
-              mappages(child->pagetable, addr, PGSIZE, (uint64)mem, PTE_FLAGS(*pte));
-            }
-          }
+  for(ma = mmap_first(p); ma; ma = mmap_next(p, ma)) {
+    if(!(ma->flags & MAP_SHARED) || ma->f)
+      continue;
+    perm = PTE_U | PTE_R | ((ma->prot & PROT_WRITE) ? PTE_W : 0);
+    for(uint64 addr = ma->addr; addr < ma->addr + ma->length; addr += PGSIZE) {
+      pte = walk(p->pagetable, addr, 0);
+      if(pte && (*pte & PTE_V))
+        continue;
+      if((mem = kalloc_user()) == 0)
+        return -1;
+      kpage_settype(mem, PG_ANON);
+      if(mappages(p->pagetable, addr, PGSIZE, (uint64)mem, perm) != 0) {
+        kfree(mem);
+        return -1;
+      }
+      n++;
+    }
+  }
+  if(n > 0)
+    tlb_flush(p);
+  return 0;
+}
 
-          break;
+// Copy parent's mmap areas to child.
+// Returns -1 if out of memory; the caller then
+// removes the areas already copied with munmap_all().
+static int
+copy_mmap_areas(struct proc *parent, struct proc *child)
+{
+  struct mmap_area *ma, *nma;
+
+  for(ma = mmap_first(parent); ma; ma = mmap_next(parent, ma)) {
+    // Copy the mmap area to the child process
+    if((nma = mmap_alloc()) == 0)
+      return -1;
+    *nma = *ma;
+    if(mmap_insert(child, nma, 0) < 0)
+      panic("copy_mmap_areas");
+    if(nma->f)
+      filedup(nma->f);
+
+    // Copy the virtual address range of the mmap area
+    uint64 start = ma->addr;
+    uint64 end = start + ma->length;
+
+    for(uint64 addr = start; addr < end; addr += PGSIZE) {
+      // A megapage is shared as a whole
+      pte_t *pte = walkmega(parent->pagetable, addr);
+      if(pte) {
+        if(uvmshare(pte, child->pagetable, addr, MEGAPGSIZE) != 0)
+          return -1;
+        addr += MEGAPGSIZE - PGSIZE;
+        continue;
+      }
+      // Get the page table entry of the parent process
+      pte = walk(parent->pagetable, addr, 0);
+      // A swapped-out page shares the parent's swap slot
+      if(pte && (*pte & PTE_S)) {
+        if(uvmcopyswap(child->pagetable, addr, *pte) != 0)
+          return -1;
+        continue;
+      }
+      // A page of a shared mapping is simply mapped in the child
+      // too (fill_shared() has given shared anonymous memory all
+      // its pages); for a file, the parent writes back what it
+      // dirtied
+      if(pte && (*pte & PTE_V) && (ma->flags & MAP_SHARED)) {
+        kpage_get((void*)PTE2PA(*pte));
+        if(mappages(child->pagetable, addr, PGSIZE, PTE2PA(*pte), PTE_FLAGS(*pte) & ~PTE_D) != 0){
+          kpage_put((void*)PTE2PA(*pte));
+          return -1;
         }
+        continue;
+      }
+      // A resident page is shared copy-on-write with the child
+      if(pte && (*pte & PTE_V)) {
+        if(uvmshare(pte, child->pagetable, addr, PGSIZE) != 0)
+          return -1;
       }
     }
   }
+  return 0;
 }
 
 // Create a new process, copying the parent.
@@ -396,21 +474,37 @@ fork(void)
   struct proc *np;
   struct proc *p = myproc();
 
+  // Make room before np->lock is held; reclaim() takes proc locks.
+  if(fill_shared(p) < 0)
+    return -1;
+  reclaim_check();
+
   // Allocate process.
   if((np = allocproc()) == 0){
     return -1;
   }
 
-  // Copy user memory from parent to child.
+  // Share user memory with the child copy-on-write. This takes
+  // write access away from the parent's PTEs, so flush its TLB
+  // whether or not the copy succeeds.
   if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
+    tlb_flush(p);
     freeproc(np);
     release(&np->lock);
     return -1;
   }
   np->sz = p->sz;
 
-  // Copy mmap areas from parent to child
-  copy_mmap_areas(p, np);
+  // Copy mmap areas from parent to child. The parent still holds
+  // references to the mapped files, so munmap_all() cannot sleep.
+  if(copy_mmap_areas(p, np) < 0){
+    tlb_flush(p);
+    munmap_all(np);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  tlb_flush(p);
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -423,6 +517,10 @@ fork(void)
     if(p->ofile[i])
       np->ofile[i] = filedup(p->ofile[i]);
   np->cwd = idup(p->cwd);
+  if(p->execip)
+    np->execip = idup(p->execip);
+  memmove(np->seg, p->seg, sizeof(p->seg));
+  np->nseg = p->nseg;
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
@@ -464,11 +562,17 @@ reparent(struct proc *p)
   }
 }
 
-void munmap_all(struct proc *p) {
-  for(int i=0; i<MAX_MMAP_AREA; i++){
-    if(mmap_areas[i].used && mmap_areas[i].p == p){
-      sys_munmap_addrlen(mmap_areas[i].addr, mmap_areas[i].length);
-    }
+// Unmap all of p's mmap areas and free their pages.
+// May sleep closing the mapped files.
+void
+munmap_all(struct proc *p)
+{
+  struct mmap_area *ma;
+
+  while((ma = mmap_first(p)) != 0){
+    mmap_writeback(p, ma, ma->addr, ma->addr + ma->length);
+    uvmunmap(p->pagetable, ma->addr, ma->length / PGSIZE, 1);
+    mmap_remove(p, ma);
   }
 }
 
@@ -483,6 +587,9 @@ exit(int status)
   if(p == initproc)
     panic("init exiting");
 
+  // Clean up mmap areas before the files they map are closed.
+  munmap_all(p);
+
   // Close all open files.
   for(int fd = 0; fd < NOFILE; fd++){
     if(p->ofile[fd]){
@@ -494,8 +601,12 @@ exit(int status)
 
   begin_op();
   iput(p->cwd);
+  if(p->execip)
+    iput(p->execip);
   end_op();
   p->cwd = 0;
+  p->execip = 0;
+  p->nseg = 0;
 
   acquire(&wait_lock);
 
@@ -510,9 +621,6 @@ exit(int status)
   p->xstate = status;
   p->state = ZOMBIE;
 
-  // Clean up mmap areas before freeing page table
-  munmap_all(p);
-
   release(&wait_lock);
 
   // Jump into the scheduler, never to return.
@@ -532,6 +640,7 @@ wait(uint64 addr)
   acquire(&wait_lock);
 
   for(;;){
+  rescan:
     // Scan through table looking for exited children.
     havekids = 0;
     for(pp = proc; pp < &proc[NPROC]; pp++){
@@ -547,7 +656,12 @@ wait(uint64 addr)
                                   sizeof(pp->xstate)) < 0) {
             release(&pp->lock);
             release(&wait_lock);
-            return -1;
+            // addr may just be swapped out or copy-on-write;
+            // fix it up without the locks and look again.
+            if(uvmfault(p->pagetable, addr, 1) < 0)
+              return -1;
+            acquire(&wait_lock);
+            goto rescan;
           }
           freeproc(pp);
           release(&pp->lock);
@@ -693,6 +807,10 @@ scheduler(void)
       }
       release(&p->lock);
       best = 0;
+    } else {
+      // Nothing to run: spend the idle time zeroing a page
+      // for kalloc_zeroed().
+      kzero_refill();
     }
   }
 }
@@ -958,21 +1076,39 @@ setnice(int pid, int value)
   return -1;
 }
 
+static char *pgtype_name[NPGTYPE] = {
+[PG_FREE]    "free",
+[PG_KERNEL]  "kernel",
+[PG_ANON]    "anon",
+[PG_FILE]    "file",
+[PG_PGTBL]   "pagetable",
+[PG_KSTACK]  "kstack",
+[PG_PIPE]    "pipe",
+};
+
 void
 meminfo(void)
 {
-  struct run *r; // pointer that points to the free memory
-  uint64 free_memory = 0; // variable to store the free memory size
-  
-  acquire(&kmem.lock); // acquire the lock
-  r = kmem.freelist; // assign the free memory to r
-  while(r) { // while r is not null
-    free_memory += PGSIZE; // add the page size to the free memory
-    r = r->next; // move to the next free memory
-  }
-  release(&kmem.lock); // release the lock
-  
-  printf("Available memory: %ld bytes\n", free_memory); // print the free memory
+  long counts[NPGTYPE];
+  int nfree[MAXORDER + 1];
+  struct memstat ms;
+
+  kpage_counts(counts); // per-type page counts summed over all harts
+  printf("Available memory: %ld bytes\n", counts[PG_FREE] * PGSIZE); // print the free memory
+  for(int t = 0; t < NPGTYPE; t++)
+    printf("  %s: %ld pages\n", pgtype_name[t], counts[t]);
+  printf("  pre-zeroed: %d pages (%lu hits, %lu misses)\n", kmem.nzero, kmem.zhit, kmem.zmiss);
+  pagecachestat(&ms);
+  printf("  page cache: %lu pages, %lu copies saved by sharing\n", ms.pcache, ms.pcsaved);
+
+  // Free buddy blocks per order; pages cached on the harts' lists are not included.
+  // Print from a copy, so that kalloc() doesn't wait on the console.
+  acquire(&kmem.lock);
+  for(int k = 0; k <= MAXORDER; k++)
+    nfree[k] = kmem.nfree[k];
+  release(&kmem.lock);
+  for(int k = 0; k <= MAXORDER; k++)
+    printf("  order %d (%d KB): %d free blocks\n", k, 4 << k, nfree[k]);
 }
 
 int
@@ -985,7 +1121,7 @@ waitpid(int pid, int *status)
   acquire(&wait_lock); // acquire the lock
 
   for(;;) {
-    
+  rescan:
     havekids = 0;
 
     for(np = proc; np < &proc[NPROC]; np++){ // scan through the table
@@ -1003,7 +1139,11 @@ waitpid(int pid, int *status)
         if(status != 0 && copyout(p->pagetable, (uint64)status, (char *)&np->xstate,
                                 sizeof(np->xstate)) < 0) { // copy the exit status to the parent
           release(&wait_lock);
-          return -1; // if the copyout fails, return -1
+          // status may just be swapped out or copy-on-write; fix it up and look again
+          if(uvmfault(p->pagetable, (uint64)status, 1) < 0)
+            return -1; // if the copyout fails, return -1
+          acquire(&wait_lock);
+          goto rescan;
         }
         freeproc(np); // free the process
         release(&wait_lock);
@@ -36,6 +36,8 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  uint64 asidgen;             // Generation of the ASIDs this hart hands out.
+  uint nextasid;              // Next ASID to hand out in this generation.
 };
 
 extern struct cpu cpus[NCPU];
@@ -90,6 +92,17 @@ struct trapframe {
   /* 264 */ uint64 t4;
   /* 272 */ uint64 t5;
   /* 280 */ uint64 t6;
+  /* 288 */ uint64 kernel_flush;  // flush the TLB on satp switches (no ASIDs)
+};
+
+// A program segment whose pages are read from the program
+// file the first time they are touched.
+struct execseg {
+  uint64 va;       // start, page-aligned
+  uint64 memsz;    // size in memory
+  uint64 filesz;   // bytes from the file; the rest is zero
+  uint off;        // file offset of the segment
+  int perm;        // PTE permissions of its pages
 };
 
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
@@ -112,15 +125,22 @@ struct proc {
   int time_slice;              // Remaining time slice
   int weight;                  // Process weight based on nice value
   int total_tick;              // Total ticks since process creation
+  int kpreempted;              // Yielded in kerneltrap, maybe in the middle of using user memory
 
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
   uint64 sz;                   // Size of process memory (bytes)
   pagetable_t pagetable;       // User page table
+  uint64 asid[NCPU];           // Per hart: ASID generation << 16 | ASID, or 0
   struct trapframe *trapframe; // data page for trampoline.S
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  struct inode *execip;        // Program file, while segments load from it
+  struct execseg seg[NEXECSEG]; // Segments loaded on demand
+  int nseg;                    // Entries in seg[]
+  int nsleeplock;              // Sleep-locks held, see execfault()
+  struct mmap_area *mmaps;     // Tree of mmap areas, see mmap.h
   char name[16];               // Process name (debugging)
 };
 
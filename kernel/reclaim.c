@@ -0,0 +1,245 @@
+// Page reclaim.
+//
+// When free memory runs low, reclaim() first frees page-cache
+// pages that no process maps, then takes pages back from user
+// processes. Clean file pages are simply unmapped, even if
+// other processes map them too; a later access faults them back
+// in through handle_mmap_fault() or execfault(). Anonymous pages, and file pages
+// the process has written to, are written to swap (see swap.c)
+// and brought back by swapin().
+//
+// Pages are picked by a clock (second-chance) scan of the
+// PTE_A bits the MMU sets on every access: a page whose bit is
+// set has the bit cleared and is skipped, a page whose bit is
+// still clear when the hand comes around again is evicted. A
+// megapage is aged as a whole, and split into 4KB pages once
+// it has gone cold.
+//
+// Besides the calling process itself, only processes that are
+// not running, and that did not give up the CPU in the middle
+// of kernel code, are scanned. No hart then holds a physical
+// address for a page that is taken away, and tlb_flush() makes
+// sure no TLB entry for it is used again.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "kalloc.h"
+#include "mmap.h"
+#include "memstat.h"
+
+extern struct proc proc[NPROC];
+
+// A page taken for swap-out, still to be written.
+struct victim {
+  int slot;
+  void *pa;
+};
+
+struct {
+  struct spinlock lock;  // protects the clock hand and counters
+  int hand;              // proc[] slot the clock hand is in
+  uint64 hand_va;        // next address to look at in that process
+  uint64 nscan;          // mapped pages examined
+  uint64 nreclaim;       // pages evicted
+  uint64 nrun;           // calls to reclaim()
+} rc;
+
+void
+reclaiminit(void)
+{
+  initlock(&rc.lock, "reclaim");
+}
+
+// Look at p's page at va, and take it if it is cold: drop it
+// if it is a clean file page, or unmap it and add it to v[*nv]
+// for swap-out. Returns 1 if the page was taken.
+// Caller must hold rc.lock and p->lock.
+static int
+scan_page(struct proc *p, uint64 va, struct victim *v, int *nv)
+{
+  pte_t *pte;
+  uint64 pa;
+  int slot;
+
+  pte = walk(p->pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0)
+    return 0;
+  rc.nscan++;
+  if(*pte & PTE_A){
+    *pte &= ~PTE_A;   // second chance
+    return 0;
+  }
+  pa = PTE2PA(*pte);
+  if(PA2PAGE(pa)->type == PG_FILE && (*pte & PTE_D) == 0){
+    // the file has the data, even if the page is shared
+    uvmclearpte(p->pagetable, va, 0);
+    kpage_put((void*)pa);
+    return 1;
+  }
+  if(kpage_ref((void*)pa) > 1)
+    return 0;   // shared copy-on-write with another process
+  if((slot = swap_alloc()) < 0)
+    return 0;
+  *pte = SLOT2PTE(slot) | (PTE_FLAGS(*pte) & ~(PTE_V|PTE_A|PTE_D)) | PTE_S;
+  v[*nv].slot = slot;
+  v[*nv].pa = (void*)pa;
+  (*nv)++;
+  return 1;
+}
+
+// If va is in one of p's megapages, give the megapage a
+// second chance as a whole if it was used, or else split it
+// so that scan_page() can take its pages one at a time.
+// Returns 1 if the scan should skip the rest of the megapage.
+// Caller must hold rc.lock and p->lock.
+static int
+scan_mega(struct proc *p, uint64 va)
+{
+  pte_t *pte = walkmega(p->pagetable, va);
+
+  if(pte == 0)
+    return 0;
+  if(*pte & PTE_A){
+    *pte &= ~PTE_A;
+    return 1;
+  }
+  return uvmsplit(p->pagetable, va) < 0;
+}
+
+// Scan p's heap and mmap areas at or above rc.hand_va, taking
+// up to target pages. Shared anonymous memory is left alone:
+// a swapped-out page would come back as a copy per process.
+// Returns the number taken.
+// Caller must hold rc.lock and p->lock.
+static int
+scan_proc(struct proc *p, int target, struct victim *v, int *nv)
+{
+  struct mmap_area *ma;
+  uint64 va;
+  int n = 0;
+
+  for(va = PGROUNDUP(rc.hand_va); va < p->sz && n < target; va += PGSIZE){
+    if(scan_mega(p, va))
+      va = MEGAPGROUNDDOWN(va) + MEGAPGSIZE - PGSIZE;
+    else
+      n += scan_page(p, va, v, nv);
+    rc.hand_va = va + PGSIZE;
+  }
+
+  for(ma = mmap_first(p); ma && n < target; ma = mmap_next(p, ma)){
+    if((ma->flags & MAP_SHARED) && ma->f == 0)
+      continue;
+    for(va = ma->addr; va < ma->addr + ma->length && n < target; va += PGSIZE){
+      if(va < rc.hand_va)
+        continue;
+      if(scan_mega(p, va)){
+        va = MEGAPGROUNDDOWN(va) + MEGAPGSIZE - PGSIZE;
+        continue;
+      }
+      n += scan_page(p, va, v, nv);
+      if(n == target)
+        rc.hand_va = va + PGSIZE;
+    }
+  }
+  return n;
+}
+
+// Move the clock hand until up to target pages are taken,
+// at most two full turns (the first may only clear access
+// bits). Returns the number taken.
+static int
+clock_scan(int target, struct victim *v, int *nv)
+{
+  struct proc *p;
+  int n = 0;
+
+  acquire(&rc.lock);
+  for(int i = 0; i <= 2*NPROC && n < target; i++){
+    p = &proc[rc.hand];
+    acquire(&p->lock);
+    if(p == myproc() ||
+       ((p->state == SLEEPING || p->state == RUNNABLE) && !p->kpreempted)){
+      n += scan_proc(p, target - n, v, nv);
+      tlb_flush(p);  // PTEs changed, if only the access bits
+    }
+    release(&p->lock);
+    if(n < target){
+      rc.hand = (rc.hand + 1) % NPROC;
+      rc.hand_va = 0;
+    }
+  }
+  rc.nreclaim += n;
+  release(&rc.lock);
+  return n;
+}
+
+// Try to free target pages. Returns the number freed,
+// which is 0 if nothing could be evicted.
+// Must not be called with a spinlock held; may sleep.
+int
+reclaim(int target)
+{
+  struct victim v[RECLAIM_BATCH];
+  int n = 0, got, nv;
+
+  acquire(&rc.lock);
+  rc.nrun++;
+  release(&rc.lock);
+
+  // Cached file pages no process maps go first.
+  n = pagecache_reclaim(target);
+
+  swap_lock();
+  while(n < target){
+    nv = 0;
+    got = clock_scan(target - n < RECLAIM_BATCH ? target - n : RECLAIM_BATCH, v, &nv);
+    for(int i = 0; i < nv; i++){
+      swap_write(v[i].slot, v[i].pa);
+      kpage_put(v[i].pa);
+    }
+    if(got == 0)
+      break;
+    n += got;
+  }
+  swap_unlock();
+  return n;
+}
+
+// Reclaim pages if free memory is below the low watermark.
+void
+reclaim_check(void)
+{
+  int nfree = freemem_count();
+
+  if(nfree < KMEM_LOW)
+    reclaim(KMEM_LOW - nfree);
+}
+
+// Allocate a zeroed page for user memory, reclaiming first
+// if free memory is low and again before giving up.
+// Returns 0 if no page can be found.
+void*
+kalloc_user(void)
+{
+  void *mem;
+
+  reclaim_check();
+  if((mem = kalloc_zeroed()) == 0 && reclaim(RECLAIM_BATCH) > 0)
+    mem = kalloc_zeroed();
+  return mem;
+}
+
+void
+reclaimstat(struct memstat *ms)
+{
+  acquire(&rc.lock);
+  ms->nscan = rc.nscan;
+  ms->nreclaim = rc.nreclaim;
+  ms->nreclaimrun = rc.nrun;
+  release(&rc.lock);
+}
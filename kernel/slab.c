@@ -0,0 +1,263 @@
+// Object-cache (slab) allocator for small fixed-size kernel
+// objects such as pipes, open files, in-memory inodes and
+// mmap areas.
+//
+// Each cache carves whole pages from kalloc() into equal-sized
+// objects. Slabs live on one of three lists (partial, full,
+// empty) protected by the cache lock. In front of the slabs
+// every hart keeps a small magazine of free objects, so most
+// allocations and frees never take the cache lock.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "kalloc.h"
+#include "slab.h"
+#include "memstat.h"
+
+// All caches, for slabinfo().
+static struct spinlock cachelist_lock;
+static struct kmem_cache *caches;
+
+#define SLAB_ALIGN 16
+#define SLAB_HDR   ((sizeof(struct slab) + SLAB_ALIGN - 1) & ~(SLAB_ALIGN - 1))
+
+static void
+slab_list_init(struct slab *head)
+{
+  head->next = head;
+  head->prev = head;
+}
+
+static void
+slab_unlink(struct slab *s)
+{
+  s->prev->next = s->next;
+  s->next->prev = s->prev;
+}
+
+static void
+slab_push(struct slab *head, struct slab *s)
+{
+  s->next = head->next;
+  s->prev = head;
+  head->next->prev = s;
+  head->next = s;
+}
+
+void
+slabinit(void)
+{
+  initlock(&cachelist_lock, "cachelist");
+}
+
+// Set up a cache of objects of the given size.
+// Caches are statically allocated by their users. Slab pages
+// are accounted to the given PG_* owner type.
+void
+kmem_cache_init(struct kmem_cache *c, char *name, uint size, int pgtype)
+{
+  size = (size + SLAB_ALIGN - 1) & ~(SLAB_ALIGN - 1);
+  if(size == 0 || SLAB_HDR + size > PGSIZE)
+    panic("kmem_cache_init: size");
+
+  initlock(&c->lock, name);
+  c->name = name;
+  c->size = size;
+  c->perslab = (PGSIZE - SLAB_HDR) / size;
+  slab_list_init(&c->partial);
+  slab_list_init(&c->full);
+  slab_list_init(&c->empty);
+  c->nslabs = 0;
+  c->nempty = 0;
+  c->pgtype = pgtype;
+  memset(c->mag, 0, sizeof(c->mag));
+
+  acquire(&cachelist_lock);
+  c->next = caches;
+  caches = c;
+  release(&cachelist_lock);
+}
+
+// Carve a fresh page into objects.
+// Caller must hold c->lock.
+static struct slab*
+slab_grow(struct kmem_cache *c)
+{
+  struct slab *s;
+  char *obj;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return 0;
+  if(c->pgtype != PG_KERNEL)
+    kpage_settype(s, c->pgtype);
+  s->cache = c;
+  s->freelist = 0;
+  s->inuse = 0;
+  obj = (char*)s + SLAB_HDR;
+  for(int i = 0; i < c->perslab; i++, obj += c->size){
+    *(void**)obj = s->freelist;
+    s->freelist = obj;
+  }
+  slab_push(&c->empty, s);
+  c->nslabs++;
+  c->nempty++;
+  return s;
+}
+
+// Take one object out of the slabs.
+// Caller must hold c->lock.
+static void*
+slab_get(struct kmem_cache *c)
+{
+  struct slab *s;
+  void *obj;
+
+  if(c->partial.next != &c->partial){
+    s = c->partial.next;
+  } else {
+    if(c->empty.next == &c->empty && slab_grow(c) == 0)
+      return 0;
+    s = c->empty.next;
+    slab_unlink(s);
+    c->nempty--;
+    slab_push(&c->partial, s);
+  }
+
+  obj = s->freelist;
+  s->freelist = *(void**)obj;
+  s->inuse++;
+  if(s->freelist == 0){
+    slab_unlink(s);
+    slab_push(&c->full, s);
+  }
+  return obj;
+}
+
+// Return one object to its slab. Keeps at most one
+// empty slab per cache; further empty pages go back to kfree().
+// Caller must hold c->lock.
+static void
+slab_put(struct kmem_cache *c, void *obj)
+{
+  struct slab *s = (struct slab*)PGROUNDDOWN((uint64)obj);
+
+  if(s->cache != c)
+    panic("slab_put: wrong cache");
+
+  if(s->freelist == 0){
+    slab_unlink(s);
+    slab_push(&c->partial, s);
+  }
+  *(void**)obj = s->freelist;
+  s->freelist = obj;
+  s->inuse--;
+  if(s->inuse == 0){
+    slab_unlink(s);
+    if(c->nempty > 0){
+      c->nslabs--;
+      kfree((void*)s);
+    } else {
+      slab_push(&c->empty, s);
+      c->nempty++;
+    }
+  }
+}
+
+// Allocate one object. Returns 0 if out of memory.
+// The object's contents are undefined.
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  struct magazine *m;
+  void *obj = 0;
+  int hit = 1;
+
+  push_off();
+  m = &c->mag[cpuid()];
+  if(m->n == 0){
+    // Magazine is empty: refill half of it from the slabs.
+    hit = 0;
+    acquire(&c->lock);
+    while(m->n < MAG_SIZE/2){
+      void *o = slab_get(c);
+      if(o == 0)
+        break;
+      m->objs[m->n++] = o;
+    }
+    release(&c->lock);
+  }
+  if(m->n > 0){
+    obj = m->objs[--m->n];
+    m->nalloc++;
+    if(hit)
+      m->nhit++;
+  }
+  pop_off();
+  return obj;
+}
+
+// Free an object previously returned by kmem_cache_alloc(c).
+void
+kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+  struct magazine *m;
+
+  push_off();
+  m = &c->mag[cpuid()];
+  if(m->n == MAG_SIZE){
+    // Magazine is full: give half of it back to the slabs.
+    acquire(&c->lock);
+    while(m->n > MAG_SIZE/2)
+      slab_put(c, m->objs[--m->n]);
+    release(&c->lock);
+  }
+  m->objs[m->n++] = obj;
+  m->nfree++;
+  pop_off();
+}
+
+// Fill in up to max slabstat records, one per cache.
+// Returns the number of records filled in.
+int
+slabstat(struct slabstat *st, int max)
+{
+  struct kmem_cache *c;
+  int n = 0;
+
+  acquire(&cachelist_lock);
+  for(c = caches; c && n < max; c = c->next, n++){
+    uint64 nalloc = 0, nfree = 0, nhit = 0;
+    for(int i = 0; i < NCPU; i++){
+      nalloc += c->mag[i].nalloc;
+      nfree += c->mag[i].nfree;
+      nhit += c->mag[i].nhit;
+    }
+    safestrcpy(st[n].name, c->name, sizeof(st[n].name));
+    st[n].objsize = c->size;
+    st[n].perslab = c->perslab;
+    st[n].nslabs = c->nslabs;
+    st[n].active = nalloc - nfree;
+    st[n].nalloc = nalloc;
+    st[n].nhit = nhit;
+  }
+  release(&cachelist_lock);
+  return n;
+}
+
+// Total number of pages held by all caches.
+int
+slab_npages(void)
+{
+  struct kmem_cache *c;
+  int n = 0;
+
+  acquire(&cachelist_lock);
+  for(c = caches; c; c = c->next)
+    n += c->nslabs;
+  release(&cachelist_lock);
+  return n;
+}
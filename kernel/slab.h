@@ -0,0 +1,45 @@
+#ifndef _SLAB_H_
+#define _SLAB_H_
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+
+#define MAG_SIZE 16   // objects cached per hart in each cache's magazine
+
+// A slab is one page: this header followed by equal-sized objects.
+struct slab {
+  struct kmem_cache *cache; // cache this slab belongs to
+  struct slab *next;        // next slab on the cache's list
+  struct slab *prev;
+  void *freelist;           // free objects in this slab
+  int inuse;                // objects handed out from this slab
+};
+
+// Per-hart stack of free objects. Only touched by its own hart
+// with interrupts off, so it needs no lock.
+struct magazine {
+  int n;                    // number of objects in objs[]
+  void *objs[MAG_SIZE];
+  uint64 nalloc;            // objects allocated on this hart
+  uint64 nfree;             // objects freed on this hart
+  uint64 nhit;              // allocations served from the magazine
+};
+
+// An object cache for one kind of fixed-size kernel object.
+struct kmem_cache {
+  struct spinlock lock;     // protects the slab lists
+  char *name;
+  uint size;                // object size, rounded up for alignment
+  int perslab;              // objects per slab page
+  struct slab partial;      // slabs with some free objects
+  struct slab full;         // slabs with no free objects
+  struct slab empty;        // slabs with every object free
+  int nslabs;               // pages owned by this cache
+  int nempty;               // slabs on the empty list
+  int pgtype;               // PG_* owner type of the slab pages
+  struct magazine mag[NCPU];
+  struct kmem_cache *next;  // all caches, for statistics
+};
+
+#endif // _SLAB_H_
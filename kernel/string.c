@@ -1,13 +1,27 @@
 #include "types.h"
 
+// The mem* and strnlen() functions below move a 64-bit word
+// at a time through the 8-byte-aligned middle of a buffer,
+// since they copy and clear whole pages.
+#define WORDALIGNED(p) (((uint64)(p) & 7) == 0)
+#define ONES  0x0101010101010101UL
+#define HIGHS 0x8080808080808080UL
+#define HASZERO(w) (((w) - ONES) & ~(w) & HIGHS)  // some byte of w is 0
+
 void*
 memset(void *dst, int c, uint n)
 {
   char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  uint64 w = ONES * (uchar)c;
+
+  while(n > 0 && !WORDALIGNED(cdst)){
+    *cdst++ = c;
+    n--;
   }
+  for(; n >= 8; n -= 8, cdst += 8)
+    *(uint64*)cdst = w;
+  while(n-- > 0)
+    *cdst++ = c;
   return dst;
 }
 
@@ -41,11 +55,31 @@ memmove(void *dst, const void *src, uint n)
   if(s < d && s + n > d){
     s += n;
     d += n;
+    if(WORDALIGNED((uint64)s ^ (uint64)d)){
+      while(n > 0 && !WORDALIGNED(d)){
+        *--d = *--s;
+        n--;
+      }
+      for(; n >= 8; n -= 8){
+        s -= 8;
+        d -= 8;
+        *(uint64*)d = *(const uint64*)s;
+      }
+    }
     while(n-- > 0)
       *--d = *--s;
-  } else
+  } else {
+    if(WORDALIGNED((uint64)s ^ (uint64)d)){
+      while(n > 0 && !WORDALIGNED(d)){
+        *d++ = *s++;
+        n--;
+      }
+      for(; n >= 8; n -= 8, s += 8, d += 8)
+        *(uint64*)d = *(const uint64*)s;
+    }
     while(n-- > 0)
       *d++ = *s++;
+  }
 
   return dst;
 }
@@ -95,6 +129,25 @@ safestrcpy(char *s, const char *t, int n)
   return os;
 }
 
+// Length of the string at s, or n if none of its
+// first n bytes is a NUL.
+uint64
+strnlen(const char *s, uint64 n)
+{
+  uint64 i = 0;
+
+  for(; i < n && !WORDALIGNED(s + i); i++)
+    if(s[i] == 0)
+      return i;
+  for(; i + 8 <= n; i += 8)
+    if(HASZERO(*(const uint64*)(s + i)))
+      break;
+  for(; i < n; i++)
+    if(s[i] == 0)
+      return i;
+  return n;
+}
+
 int
 strlen(const char *s)
 {
@@ -0,0 +1,176 @@
+// Swap space for anonymous user pages.
+//
+// mkfs reserves SWAPSIZE blocks after the file system and
+// records them in the superblock. The area is divided into
+// page-sized slots that are read and written with one virtio
+// request each, bypassing the buffer cache.
+//
+// A swapped-out page has a PTE with PTE_V clear, PTE_S set,
+// the slot number in the PPN field and the page's permission
+// bits kept as they were. Each slot has a reference count so
+// that fork() can share a swapped page between parent and
+// child without reading it back in.
+//
+// reclaim() holds swap.io while it picks victims and writes
+// them out, and swapin() holds it while reading, so a page is
+// never read back before it has been written.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "defs.h"
+#include "fs.h"
+#include "kalloc.h"
+#include "memstat.h"
+
+#define SLOTBLOCKS (PGSIZE / BSIZE)
+
+struct {
+  struct spinlock lock;    // protects ref[] and the counters
+  struct sleeplock io;     // held across swap-out and swap-in
+  uint start;              // first block of the swap area
+  int nslot;               // usable slots, 0 if there is no swap area
+  int nused;               // slots with a non-zero ref
+  int hint;                // where to start looking for a free slot
+  uchar ref[NSWAPSLOT];    // PTEs referring to each slot
+  uint64 nswapin;          // pages read back in
+  uint64 nswapout;         // pages written out
+} swap;
+
+void
+swapinit(void)
+{
+  initlock(&swap.lock, "swap");
+  initsleeplock(&swap.io, "swapio");
+}
+
+// Start swapping to the area the superblock describes.
+// Called by fsinit() once the superblock has been read.
+void
+swap_attach(struct superblock *sb)
+{
+  swap.start = sb->swapstart;
+  swap.nslot = sb->nswap / SLOTBLOCKS;
+  if(swap.nslot > NSWAPSLOT)
+    swap.nslot = NSWAPSLOT;
+}
+
+// Allocate a slot. Returns its number, or -1 if swap is full.
+int
+swap_alloc(void)
+{
+  int slot = -1;
+
+  acquire(&swap.lock);
+  for(int i = 0; i < swap.nslot; i++){
+    int s = (swap.hint + i) % swap.nslot;
+    if(swap.ref[s] == 0){
+      swap.ref[s] = 1;
+      swap.nused++;
+      swap.hint = s + 1;
+      slot = s;
+      break;
+    }
+  }
+  release(&swap.lock);
+  return slot;
+}
+
+// Add a reference to a slot, for a PTE copied by fork().
+void
+swap_dup(int slot)
+{
+  acquire(&swap.lock);
+  if(slot < 0 || slot >= swap.nslot || swap.ref[slot] == 0 || swap.ref[slot] == 255)
+    panic("swap_dup");
+  swap.ref[slot]++;
+  release(&swap.lock);
+}
+
+// Drop a reference to a slot.
+void
+swap_free(int slot)
+{
+  acquire(&swap.lock);
+  if(slot < 0 || slot >= swap.nslot || swap.ref[slot] == 0)
+    panic("swap_free");
+  if(--swap.ref[slot] == 0)
+    swap.nused--;
+  release(&swap.lock);
+}
+
+void
+swap_lock(void)
+{
+  acquiresleep(&swap.io);
+}
+
+void
+swap_unlock(void)
+{
+  releasesleep(&swap.io);
+}
+
+// Write the page at pa to slot. Caller must hold swap.io.
+void
+swap_write(int slot, void *pa)
+{
+  virtio_disk_rwpage(swap.start + slot * SLOTBLOCKS, pa, 1);
+  acquire(&swap.lock);
+  swap.nswapout++;
+  release(&swap.lock);
+}
+
+// Bring the swapped-out page at va back into memory.
+// Returns 0 on success, -1 if va is not swapped out or
+// there is no memory. Must not be called with a spinlock held.
+int
+swapin(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  char *mem;
+  int slot;
+
+  va = PGROUNDDOWN(va);
+  if(va >= MAXVA)
+    return -1;
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_S) == 0)
+    return -1;
+
+  // Allocate before taking swap.io; kalloc_user() may swap out.
+  if((mem = kalloc_user()) == 0)
+    return -1;
+  kpage_settype(mem, PG_ANON);
+
+  // Only the owning process changes a swapped PTE, so
+  // *pte is still the same; waiting for swap.io makes sure
+  // the slot has been written.
+  acquiresleep(&swap.io);
+  slot = PTE2SLOT(*pte);
+  virtio_disk_rwpage(swap.start + slot * SLOTBLOCKS, mem, 0);
+  *pte = PA2PTE(mem) | (PTE_FLAGS(*pte) & ~PTE_S) | PTE_V;
+  releasesleep(&swap.io);
+
+  swap_free(slot);
+  acquire(&swap.lock);
+  swap.nswapin++;
+  release(&swap.lock);
+  uvmflush(pagetable, va, 1);
+  return 0;
+}
+
+void
+swapstat(struct memstat *ms)
+{
+  acquire(&swap.lock);
+  ms->swaptotal = swap.nslot;
+  ms->swapused = swap.nused;
+  ms->nswapin = swap.nswapin;
+  ms->nswapout = swap.nswapout;
+  release(&swap.lock);
+}
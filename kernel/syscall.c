@@ -109,6 +109,13 @@ extern uint64 sys_waitpid(void);
 extern uint64 sys_mmap(void);
 extern uint64 sys_munmap(void);
 extern uint64 sys_freemem(void);
+extern uint64 sys_slabinfo(void);
+extern uint64 sys_memstat(void);
+extern uint64 sys_msync(void);
+extern uint64 sys_madvise(void);
+extern uint64 sys_mprotect(void);
+extern uint64 sys_munmaprange(void);
+extern uint64 sys_mremap(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -142,6 +149,13 @@ static uint64 (*syscalls[])(void) = {
 [SYS_mmap]    sys_mmap,
 [SYS_munmap]  sys_munmap,
 [SYS_freemem] sys_freemem,
+[SYS_slabinfo] sys_slabinfo,
+[SYS_memstat] sys_memstat,
+[SYS_msync]   sys_msync,
+[SYS_madvise] sys_madvise,
+[SYS_mprotect] sys_mprotect,
+[SYS_munmaprange] sys_munmaprange,
+[SYS_mremap]  sys_mremap,
 };
 
 void
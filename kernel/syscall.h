@@ -28,3 +28,10 @@
 #define SYS_mmap    27
 #define SYS_munmap  28
 #define SYS_freemem  29
+#define SYS_slabinfo 30
+#define SYS_memstat  31
+#define SYS_msync    32
+#define SYS_madvise  33
+#define SYS_mprotect 34
+#define SYS_munmaprange 35
+#define SYS_mremap   36
@@ -10,13 +10,239 @@
 #include "file.h"
 #include "fs.h"
 #include "mmap.h"
+#include "slab.h"
+#include "memstat.h"
 #include <stddef.h>
 
 extern struct proc proc[NPROC];
-extern int freemem_count;
 
-// Global mmap areas array
-struct mmap_area mmap_areas[MAX_MMAP_AREA];
+// Per-process trees of mmap areas, see mmap.h
+struct spinlock mmap_lock;
+static struct kmem_cache mmap_cache;
+
+void
+mmapinit(void)
+{
+  initlock(&mmap_lock, "mmap");
+  kmem_cache_init(&mmap_cache, "mmap_area", sizeof(struct mmap_area), PG_KERNEL);
+}
+
+// Allocate a zeroed mmap area record. Returns 0 if out of memory.
+struct mmap_area*
+mmap_alloc(void)
+{
+  struct mmap_area *ma;
+
+  if((ma = kmem_cache_alloc(&mmap_cache)) == 0)
+    return 0;
+  memset(ma, 0, sizeof(*ma));
+  return ma;
+}
+
+static int
+height(struct mmap_area *n)
+{
+  return n ? n->height : 0;
+}
+
+static struct mmap_area*
+rotate_right(struct mmap_area *n)
+{
+  struct mmap_area *l = n->left;
+
+  n->left = l->right;
+  l->right = n;
+  n->height = 1 + (height(n->left) > height(n->right) ? height(n->left) : height(n->right));
+  l->height = 1 + (height(l->left) > height(n) ? height(l->left) : height(n));
+  return l;
+}
+
+static struct mmap_area*
+rotate_left(struct mmap_area *n)
+{
+  struct mmap_area *r = n->right;
+
+  n->right = r->left;
+  r->left = n;
+  n->height = 1 + (height(n->left) > height(n->right) ? height(n->left) : height(n->right));
+  r->height = 1 + (height(n) > height(r->right) ? height(n) : height(r->right));
+  return r;
+}
+
+// Restore the AVL balance at n after one of its subtrees
+// grew or shrank by one. Returns the new subtree root.
+static struct mmap_area*
+balance(struct mmap_area *n)
+{
+  int b = height(n->left) - height(n->right);
+
+  if(b > 1){
+    if(height(n->left->left) < height(n->left->right))
+      n->left = rotate_left(n->left);
+    return rotate_right(n);
+  }
+  if(b < -1){
+    if(height(n->right->right) < height(n->right->left))
+      n->right = rotate_right(n->right);
+    return rotate_left(n);
+  }
+  n->height = 1 + (b > 0 ? height(n->left) : height(n->right));
+  return n;
+}
+
+static struct mmap_area*
+tree_insert(struct mmap_area *n, struct mmap_area *ma)
+{
+  if(n == 0){
+    ma->left = ma->right = 0;
+    ma->height = 1;
+    return ma;
+  }
+  if(ma->addr < n->addr)
+    n->left = tree_insert(n->left, ma);
+  else
+    n->right = tree_insert(n->right, ma);
+  return balance(n);
+}
+
+// Unlink the lowest area under n into *min.
+static struct mmap_area*
+tree_remove_min(struct mmap_area *n, struct mmap_area **min)
+{
+  if(n->left == 0){
+    *min = n;
+    return n->right;
+  }
+  n->left = tree_remove_min(n->left, min);
+  return balance(n);
+}
+
+static struct mmap_area*
+tree_remove(struct mmap_area *n, struct mmap_area *ma)
+{
+  struct mmap_area *m;
+
+  if(n == ma){
+    if(n->right == 0)
+      return n->left;
+    n->right = tree_remove_min(n->right, &m);
+    m->left = n->left;
+    m->right = n->right;
+    return balance(m);
+  }
+  if(ma->addr < n->addr)
+    n->left = tree_remove(n->left, ma);
+  else
+    n->right = tree_remove(n->right, ma);
+  return balance(n);
+}
+
+// Find p's area that overlaps [start, end), or 0.
+// Caller must hold mmap_lock.
+static struct mmap_area*
+tree_find(struct proc *p, uint64 start, uint64 end)
+{
+  struct mmap_area *n = p->mmaps;
+
+  while(n){
+    if(end <= n->addr)
+      n = n->left;
+    else if(start >= n->addr + n->length)
+      n = n->right;
+    else
+      break;
+  }
+  return n;
+}
+
+// Find p's lowest area above addr, or 0.
+// Caller must hold mmap_lock.
+static struct mmap_area*
+tree_after(struct proc *p, uint64 addr)
+{
+  struct mmap_area *n, *best = 0;
+
+  for(n = p->mmaps; n; ){
+    if(n->addr > addr){
+      best = n;
+      n = n->left;
+    } else
+      n = n->right;
+  }
+  return best;
+}
+
+// Add a filled-in area to p's tree. If place is set, first
+// give it the lowest address above MMAPBASE where it fits.
+// Returns 0, or -1 if it overlaps another of p's areas or
+// there is no room.
+int
+mmap_insert(struct proc *p, struct mmap_area *ma, int place)
+{
+  struct mmap_area *n;
+  uint64 a;
+
+  acquire(&mmap_lock);
+  if(place){
+    // First fit: walk the areas in address order.
+    a = MMAPBASE;
+    for(n = tree_after(p, 0); n && n->addr < a + ma->length; n = tree_after(p, n->addr))
+      if(n->addr + n->length > a)
+        a = n->addr + n->length;
+    ma->addr = a;
+  }
+  if(ma->addr + ma->length > TRAPFRAME || tree_find(p, ma->addr, ma->addr + ma->length)){
+    release(&mmap_lock);
+    return -1;
+  }
+  p->mmaps = tree_insert(p->mmaps, ma);
+  release(&mmap_lock);
+  return 0;
+}
+
+// Take an area out of p's tree and free it, dropping
+// its file reference.
+void
+mmap_remove(struct proc *p, struct mmap_area *ma)
+{
+  acquire(&mmap_lock);
+  p->mmaps = tree_remove(p->mmaps, ma);
+  release(&mmap_lock);
+  if(ma->f)
+    fileclose(ma->f);
+  kmem_cache_free(&mmap_cache, ma);
+}
+
+// Find p's area that contains va, or 0.
+// Only p itself adds or removes its areas, so the result
+// stays valid after mmap_lock is released.
+struct mmap_area*
+mmap_find(struct proc *p, uint64 va)
+{
+  struct mmap_area *ma;
+
+  acquire(&mmap_lock);
+  ma = tree_find(p, va, va + 1);
+  release(&mmap_lock);
+  return ma;
+}
+
+// Return p's lowest area, or 0 if it has none.
+struct mmap_area*
+mmap_first(struct proc *p)
+{
+  return mmap_next(p, 0);
+}
+
+// Return p's next area above ma, or its lowest if ma is 0.
+struct mmap_area*
+mmap_next(struct proc *p, struct mmap_area *ma)
+{
+  acquire(&mmap_lock);
+  ma = tree_after(p, ma ? ma->addr : 0);
+  release(&mmap_lock);
+  return ma;
+}
 
 uint64
 sys_exit(void)
@@ -149,6 +375,40 @@ sys_waitpid(void)
   return waitpid(pid, (int*)status);
 }
 
+// Map all of p's file area ma from the page cache, for
+// MAP_POPULATE. NPOPULATE pages at a time are looked up
+// together, so that pages not cached yet are read with as few
+// disk requests as the file's layout allows. A private area
+// that can be written maps them copy-on-write.
+// Does not flush the TLB. Returns 0, or -1 if out of memory.
+static int
+populate_file(struct proc *p, struct mmap_area *ma, int perm)
+{
+  struct inode *ip = ma->f->ip;
+  void *pages[NPOPULATE];
+  int n, got, i;
+
+  if(!(ma->flags & MAP_SHARED) && (perm & PTE_W))
+    perm = (perm & ~PTE_W) | PTE_COW;
+  for(uint64 off = 0; off < ma->length; off += n * PGSIZE) {
+    n = (ma->length - off) / PGSIZE;
+    if(n > NPOPULATE)
+      n = NPOPULATE;
+    ilock(ip);
+    got = pagecache_getrange(ip, ma->offset + off, n, pages);
+    iunlock(ip);
+    for(i = 0; i < got; i++)
+      if(mappages(p->pagetable, ma->addr + off + i * PGSIZE, PGSIZE, (uint64)pages[i], perm) < 0)
+        break;
+    if(i < n) {
+      for(; i < got; i++)
+        kpage_put(pages[i]);
+      return -1;
+    }
+  }
+  return 0;
+}
+
 uint64
 sys_mmap(void)
 {
@@ -157,7 +417,7 @@ sys_mmap(void)
   struct file *f = NULL;
   struct proc *p = myproc();
   uint64 vstart;
-  int i;
+  struct mmap_area *ma;
 
   // fetch args
   argaddr(0, &addr);
@@ -171,24 +431,11 @@ sys_mmap(void)
   //        addr, length, prot, flags, fd, offset);
 
   // validate page alignment
-  if(addr % PGSIZE != 0 || length <= 0 || length % PGSIZE != 0) {
+  if(addr % PGSIZE != 0 || addr >= TRAPFRAME - MMAPBASE ||
+     length <= 0 || length % PGSIZE != 0) {
     // printf("mmap: invalid alignment addr=0x%lx length=%d\n", addr, length);
     return 0;
   }
-  // real virtual address
-  vstart = MMAPBASE + addr;
-
-  // overlap check
-  for(int j = 0; j < MAX_MMAP_AREA; j++){
-    if(!mmap_areas[j].used || mmap_areas[j].p != p)
-      continue;
-    uint64 s = mmap_areas[j].addr;
-    uint64 e = s + mmap_areas[j].length;
-    if(!(vstart + length <= s || vstart >= e)){
-      // printf("mmap: overlap with existing region\n");
-      return 0;            
-    }
-  }
 
   // validate prot
   if(prot != PROT_READ && prot != (PROT_READ | PROT_WRITE)) {
@@ -216,6 +463,10 @@ sys_mmap(void)
       // printf("mmap: file not readable\n");
       return 0;
     }
+    // whole pages of the file, so they can come from the page cache
+    if(offset < 0 || offset % PGSIZE != 0) {
+      return 0;
+    }
   } else { // anonymous mapping
     if(fd != -1 || offset != 0) {  // anon: no fd, offset=0
       // printf("mmap: invalid anon params fd=%d offset=%d\n", fd, offset);
@@ -223,62 +474,64 @@ sys_mmap(void)
     }
   }
 
-  // find free slot in mmap_areas
-  for(i = 0; i < MAX_MMAP_AREA; i++) {
-    if(!mmap_areas[i].used) break;
-  }
-  if(i == MAX_MMAP_AREA) {
-    // printf("mmap: no free slots\n");
+  // allocate a record for the mapping
+  if((ma = mmap_alloc()) == 0) {
+    // printf("mmap: out of memory\n");
     return 0;
   }
 
-  // Record mapping info in the found slot
-  mmap_areas[i].used   = 1;
-  mmap_areas[i].p      = p;
-  mmap_areas[i].f      = f;
-  mmap_areas[i].addr   = vstart;
-  mmap_areas[i].length = length;
-  mmap_areas[i].offset = offset;
-  mmap_areas[i].prot   = prot;
-  mmap_areas[i].flags  = flags;
+  // Record mapping info; addr 0 lets the kernel pick the
+  // real virtual address, else it is MMAPBASE + addr
+  ma->addr   = MMAPBASE + addr;
+  ma->length = length;
+  ma->offset = offset;
+  ma->prot   = prot;
+  ma->flags  = flags;
+  ma->around = FAULTAROUND;
+  if(mmap_insert(p, ma, addr == 0) < 0) {
+    // printf("mmap: overlap with existing region\n");
+    kmem_cache_free(&mmap_cache, ma);
+    return 0;
+  }
+  ma->f      = f ? filedup(f) : 0; // reclaim may re-read pages later
+  vstart     = ma->addr;
 
   // printf("mmap: created mapping at 0x%lx length=%d\n", vstart, length);
 
   // if MAP_POPULATE: allocate & map all pages now
   if(flags & MAP_POPULATE) {
-    for(uint64 off = 0; off < (uint64)length; off += PGSIZE) {
-      char *mem = kalloc();
-      if(mem == NULL) goto error;
-      memset(mem, 0, PGSIZE);
-      if(!(flags & MAP_ANONYMOUS)) {
-        // read file
-        if(readi(f->ip, 0, (uint64)mem, offset + off, PGSIZE) < 0)
-          goto error;
+    // map pte flags
+    int perm = PTE_U | PTE_R | ((prot & PROT_WRITE) ? PTE_W : 0);
+    if(f) {
+      // file: the page cache's pages, read in batches
+      if(populate_file(p, ma, perm) < 0) goto error;
+    } else for(uint64 off = 0; off < (uint64)length; off += PGSIZE) {
+      // anonymous memory: a megapage for each aligned 2MB,
+      // unless fork must share it page by page
+      if((vstart + off) % MEGAPGSIZE == 0 && !(flags & MAP_SHARED) &&
+         uvmmapmega(p->pagetable, vstart + off, vstart, vstart + length, perm, PG_ANON) == 0) {
+        off += MEGAPGSIZE - PGSIZE;
+        continue;
       }
-      // map pte flags
-      int perm = PTE_U | PTE_R | ((prot & PROT_WRITE) ? PTE_W : 0);
-      if(mappages(p->pagetable, vstart + off, PGSIZE, (uint64)mem, perm) < 0)
+      char *mem = kalloc_user();
+      if(mem == NULL) goto error;
+      kpage_settype(mem, PG_ANON);
+      if(mappages(p->pagetable, vstart + off, PGSIZE, (uint64)mem, perm) < 0){
+        kfree(mem);
         goto error;
-      // page table mapping and TLB invalidation
-      sfence_vma();
+      }
     }
+    // one TLB invalidation for the new mappings
+    uvmflush(p->pagetable, vstart, length / PGSIZE);
   }
 
   return vstart;
 
 error:
-  // cleanup partially populated pages
-  for(uint64 off = 0; off < (uint64)length; off += PGSIZE) {
-    pte_t *pte = walk(p->pagetable, vstart + off, 0); // get pte
-    if(pte && (*pte & PTE_V)) {
-      uint64 pa = PTE2PA(*pte); // get physical address
-      *pte = 0; // clear pte
-      memset((void*)pa, 1, PGSIZE); // fill with 1
-      kfree((void*)pa); // free page
-      sfence_vma(); // TLB invalidation
-    }
-  }
-  mmap_areas[i].used = 0; // clear slot
+  // cleanup partially populated pages, including any that
+  // were already swapped out again
+  uvmunmap(p->pagetable, vstart, length / PGSIZE, 1);
+  mmap_remove(p, ma); // drop the record
   return 0;
 }
 
@@ -298,15 +551,8 @@ sys_munmap(void)
   struct proc *p = myproc();
   struct mmap_area *ma = NULL;
   // Find the exact mapping that matches the given address
-  for (int i = 0; i < MAX_MMAP_AREA; i++) {
-    if (mmap_areas[i].used
-        && mmap_areas[i].p == p
-        && mmap_areas[i].addr == addr) {
-      ma = &mmap_areas[i];
-      break;
-    }
-  }
-  if (!ma)   // Return error if no mapping found
+  ma = mmap_find(p, addr);
+  if (!ma || ma->addr != addr)   // Return error if no mapping found
     return -1;
 
   // Pass the entire mapping length to sys_munmap_addrlen
@@ -315,44 +561,454 @@ sys_munmap(void)
 }
 
 
-// Internal helper for munmap 
+// Internal helper for munmap: unmap [addr, addr+length),
+// which may cover any pages of any number of mappings. A
+// mapping that sticks out of the range is split, and keeps
+// the part outside it.
+// Returns 1, or -1 if the range is bad or out of memory.
 int
 sys_munmap_addrlen(uint64 addr, int length)
 {
   struct proc *p = myproc();
-  struct mmap_area *ma = 0;
+  struct mmap_area *ma = 0, *next;
+  uint64 end;
 
-  // find matching mapping
-  for(int i = 0; i < MAX_MMAP_AREA; i++) {
-    if(mmap_areas[i].used && mmap_areas[i].p == p && mmap_areas[i].addr == addr) {
-      ma = &mmap_areas[i];
-      break;
-    }
+  if(addr % PGSIZE != 0 || addr >= MAXVA || length <= 0) {
+    return -1;
   }
+  end = addr + PGROUNDUP(length);
 
-  // If not found or length is greater than the mapping length
-  if(!ma || length > ma->length) {
+  // split the mappings that cross the ends of the range
+  if(mmap_splitrange(p, addr, end) < 0) {
     return -1;
   }
 
-  // free page table entries
-  int npages = length / PGSIZE;
-  uvmunmap(p->pagetable, addr, npages, 1);
-  sfence_vma();              // TLB invalidation
-
-  if(length == ma->length) { // if the entire mapping is removed
-    memset(ma, 0, sizeof(*ma)); // clear the mapping
-  } else { // if only part of the mapping is removed
-    ma->addr   += length;
-    ma->offset += length;
-    ma->length -= length;
+  // every mapping from the first at or above addr to end is
+  // now wholly in the range
+  acquire(&mmap_lock);
+  if((ma = tree_find(p, addr, addr + 1)) == 0)
+    ma = tree_after(p, addr);
+  release(&mmap_lock);
+  for(; ma && ma->addr < end; ma = next) {
+    next = mmap_next(p, ma);
+    // write stores to a shared file mapping back, then
+    // free page table entries
+    mmap_writeback(p, ma, ma->addr, ma->addr + ma->length);
+    uvmunmap(p->pagetable, ma->addr, ma->length / PGSIZE, 1);  // flushes the TLB
+    mmap_remove(p, ma); // drop the mapping record
   }
 
   return 1;
 }
 
+// Unmap any page-aligned range of the mappings, splitting
+// them as needed. Returns 1, or -1 if the range is bad.
+uint64
+sys_munmaprange(void)
+{
+  uint64 addr;
+  int length;
+
+  argaddr(0, &addr);
+  argint(1, &length);
+  return sys_munmap_addrlen(addr, length);
+}
+
+// Write the dirty pages of p's area ma in [start, end) back
+// to the file, if ma is a shared file mapping, and mark them
+// clean. A page past the end of the file is not written.
+// Returns 0, or -1 if a write failed.
+int
+mmap_writeback(struct proc *p, struct mmap_area *ma, uint64 start, uint64 end)
+{
+  // at most what filewrite() puts in one log transaction
+  uint max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  struct inode *ip;
+  pte_t *pte;
+  uint64 pa;
+  uint off, n;
+  int r = 0;
+
+  if(!(ma->flags & MAP_SHARED) || ma->f == 0)
+    return 0;
+  ip = ma->f->ip;
+  for(uint64 va = start; va < end && r == 0; va += PGSIZE) {
+    pte = walk(p->pagetable, va, 0);
+    if(pte == 0 || (*pte & (PTE_V|PTE_D)) != (PTE_V|PTE_D))
+      continue;
+    // Clean it first, so a store made meanwhile dirties it again.
+    *pte &= ~PTE_D;
+    uvmflush(p->pagetable, va, 1);
+    pa = PTE2PA(*pte);
+    off = ma->offset + (va - ma->addr);
+    // Now clean, reclaim may unmap and free the page while we
+    // sleep below; hold it until it is written.
+    kpage_get((void*)pa);
+    for(uint done = 0; done < PGSIZE && r == 0; done += n) {
+      n = PGSIZE - done < max ? PGSIZE - done : max;
+      begin_op();
+      ilock(ip);
+      if(off + done >= ip->size)
+        n = PGSIZE - done;  // past the end of the file
+      else {
+        if(off + done + n > ip->size)
+          n = ip->size - (off + done);
+        if(writei(ip, 0, pa + done, off + done, n) != n)
+          r = -1;
+      }
+      iunlock(ip);
+      end_op();
+    }
+    kpage_put((void*)pa);
+  }
+  return r;
+}
+
+// Write back stores to a shared file mapping: the pages of
+// the area at addr in [addr, addr+length).
+// Returns 0, or -1 if the range is not in one area or a write failed.
+uint64
+sys_msync(void)
+{
+  uint64 addr;
+  int length;
+  struct mmap_area *ma;
+  struct proc *p = myproc();
+
+  argaddr(0, &addr);
+  argint(1, &length);
+  if(addr % PGSIZE != 0 || length < 0)
+    return -1;
+  ma = mmap_find(p, addr);
+  if(ma == 0 || addr + length > ma->addr + ma->length)
+    return -1;
+  return mmap_writeback(p, ma, addr, addr + length);
+}
+
+// Split p's area ma at va, which must be page-aligned and
+// inside it: ma keeps the part below va, and the spare record
+// hi the rest.
+static void
+mmap_split(struct proc *p, struct mmap_area *ma, uint64 va, struct mmap_area *hi)
+{
+  *hi = *ma;
+  hi->addr   = va;
+  hi->length = ma->addr + ma->length - va;
+  hi->offset = ma->offset + (va - ma->addr);
+  ma->length = va - ma->addr;
+  if(mmap_insert(p, hi, 0) < 0)
+    panic("mmap_split");
+  if(hi->f)
+    filedup(hi->f);
+}
+
+// Split p's areas that cross start or end there, so that each
+// area lies wholly inside or outside [start, end). Both records
+// a split may need are allocated first, so the areas are split
+// as needed or not changed at all.
+// Returns 0, or -1 if out of memory.
+int
+mmap_splitrange(struct proc *p, uint64 start, uint64 end)
+{
+  struct mmap_area *ma, *spare[2];
+  int n = 0;
+
+  if((spare[0] = mmap_alloc()) == 0)
+    return -1;
+  if((spare[1] = mmap_alloc()) == 0) {
+    kmem_cache_free(&mmap_cache, spare[0]);
+    return -1;
+  }
+  if((ma = mmap_find(p, start)) != 0 && ma->addr < start)
+    mmap_split(p, ma, start, spare[n++]);
+  if((ma = mmap_find(p, end - 1)) != 0 && ma->addr + ma->length > end)
+    mmap_split(p, ma, end, spare[n++]);
+  while(n < 2)
+    kmem_cache_free(&mmap_cache, spare[n++]);
+  return 0;
+}
+
+// Whether area b continues area a, with the same settings.
+static int
+continues(struct mmap_area *a, struct mmap_area *b)
+{
+  return a->addr + a->length == b->addr && a->f == b->f &&
+         (a->f == 0 || a->offset + a->length == b->offset) &&
+         a->prot == b->prot && a->flags == b->flags && a->around == b->around;
+}
+
+// Merge p's area ma with the areas right below and above it
+// if they continue it, undoing mmap_split().
+// Returns the area that holds ma's range now.
+static struct mmap_area*
+mmap_merge(struct proc *p, struct mmap_area *ma)
+{
+  struct mmap_area *n;
+  int length;
+
+  if((n = mmap_find(p, ma->addr - 1)) != 0 && continues(n, ma)) {
+    length = ma->length;
+    mmap_remove(p, ma);
+    n->length += length;
+    ma = n;
+  }
+  if((n = mmap_find(p, ma->addr + ma->length)) != 0 && continues(ma, n)) {
+    length = n->length;
+    mmap_remove(p, n);
+    ma->length += length;
+  }
+  return ma;
+}
+
+// Find p's area holding [addr, addr+length), which must be
+// page-aligned, and if split is set split off the parts of the area outside
+// it, for a call that changes the range only.
+// Returns the area, or 0 if there is none or no memory.
+static struct mmap_area*
+mmap_range(struct proc *p, uint64 addr, int length, int split)
+{
+  struct mmap_area *ma;
+
+  if(addr % PGSIZE != 0 || length <= 0 || length % PGSIZE != 0)
+    return 0;
+  ma = mmap_find(p, addr);
+  if(ma == 0 || addr + length > ma->addr + ma->length)
+    return 0;
+  if(!split)
+    return ma;
+  if(mmap_splitrange(p, addr, addr + length) < 0)
+    return 0;
+  return mmap_find(p, addr);
+}
+
+// Tell the kernel how [addr, addr+length) of a mapping will be
+// used. MADV_RANDOM, MADV_SEQUENTIAL and MADV_NORMAL set how
+// many pages a read fault maps. MADV_WILLNEED reads the pages
+// in before they are touched: file data into the page cache,
+// swapped-out pages back into memory. MADV_DONTNEED drops the
+// pages, after writing back a shared mapping's; touching them
+// again reads them from the file or gives zeros. Shared
+// anonymous memory has nowhere to drop its pages to, so it
+// can't take MADV_DONTNEED.
+// Returns 0, or -1 on a bad argument.
+uint64
+sys_madvise(void)
+{
+  uint64 addr;
+  int length, advice;
+  struct mmap_area *ma;
+  struct proc *p = myproc();
+
+  argaddr(0, &addr);
+  argint(1, &length);
+  argint(2, &advice);
+  if(advice < MADV_NORMAL || advice > MADV_DONTNEED || length <= 0)
+    return -1;
+  length = PGROUNDUP(length);
+  // advice on how to fault applies to just the range
+  if((ma = mmap_range(p, addr, length, advice < MADV_WILLNEED)) == 0)
+    return -1;
+  if(advice == MADV_DONTNEED && (ma->flags & MAP_SHARED) && ma->f == 0)
+    return -1;
+
+  if(advice == MADV_NORMAL)
+    ma->around = FAULTAROUND;
+  else if(advice == MADV_RANDOM)
+    ma->around = 1;
+  else if(advice == MADV_SEQUENTIAL)
+    ma->around = FAULTAROUND_SEQ;
+  if(advice < MADV_WILLNEED)
+    mmap_merge(p, ma);
+  else if(advice == MADV_WILLNEED) {
+    for(uint64 a = addr; a < addr + length; a += PGSIZE) {
+      pte_t *pte = walk(p->pagetable, a, 0);
+      if(pte && (*pte & PTE_S) && swapin(p->pagetable, a) < 0)
+        break;  // out of memory; not an error for advice
+    }
+    if(ma->f) {
+      ilock(ma->f->ip);
+      pagecache_readahead(ma->f->ip, ma->offset + (addr - ma->addr), length / PGSIZE);
+      iunlock(ma->f->ip);
+    }
+  } else {
+    mmap_writeback(p, ma, addr, addr + length);
+    uvmunmap(p->pagetable, addr, length / PGSIZE, 1);  // flushes the TLB
+  }
+  return 0;
+}
+
+// Change the protection of [addr, addr+length) of a mapping to
+// prot, PROT_READ or PROT_READ|PROT_WRITE, without unmapping
+// it. The mapping is split if the range is only part of it.
+// Returns 0, or -1 on a bad argument or if out of memory.
+uint64
+sys_mprotect(void)
+{
+  uint64 addr;
+  int length, prot;
+  struct mmap_area *ma;
+  struct proc *p = myproc();
+
+  argaddr(0, &addr);
+  argint(1, &length);
+  argint(2, &prot);
+  if((prot != PROT_READ && prot != (PROT_READ | PROT_WRITE)) || length <= 0)
+    return -1;
+  length = PGROUNDUP(length);
+  // same rule as mmap: writing needs a writable file
+  ma = mmap_find(p, addr);
+  if(ma && (prot & PROT_WRITE) && ma->f && !ma->f->writable)
+    return -1;
+  if((ma = mmap_range(p, addr, length, 1)) == 0)
+    return -1;
+
+  if(uvmprotect(p->pagetable, addr, length / PGSIZE, prot & PROT_WRITE,
+                !(ma->flags & MAP_SHARED)) < 0) {
+    // Put the pages done so far back; this stops at the same
+    // megapage that could not be split.
+    uvmprotect(p->pagetable, addr, length / PGSIZE, ma->prot & PROT_WRITE,
+               !(ma->flags & MAP_SHARED));
+    mmap_merge(p, ma);
+    return -1;
+  }
+  ma->prot = prot;
+  mmap_merge(p, ma);
+  return 0;
+}
+
+// Resize the mapping [addr, addr+oldlen) to newlen bytes: in
+// place if it shrinks or the pages after it are free, else by
+// moving its pages, without copying them, to where it fits.
+// The range is split off its mapping first if it is only part
+// of one. Shared anonymous memory can't grow: a process forked
+// earlier would not see the new pages, and fault in its own.
+// Returns the mapping's address, or 0 on failure.
+uint64
+sys_mremap(void)
+{
+  uint64 addr;
+  int oldlen, newlen, grown = 0;
+  struct mmap_area *ma, *nma;
+  struct proc *p = myproc();
+
+  argaddr(0, &addr);
+  argint(1, &oldlen);
+  argint(2, &newlen);
+  if(oldlen <= 0 || newlen <= 0)
+    return 0;
+  oldlen = PGROUNDUP(oldlen);
+  newlen = PGROUNDUP(newlen);
+  ma = mmap_find(p, addr);
+  if(ma && (ma->flags & MAP_SHARED) && ma->f == 0 && newlen > oldlen)
+    return 0;
+  if((ma = mmap_range(p, addr, oldlen, 1)) == 0)
+    return 0;
+
+  if(newlen <= oldlen) {
+    if(newlen < oldlen && sys_munmap_addrlen(addr + newlen, oldlen - newlen) < 0)
+      return 0;
+    return addr;
+  }
+
+  // grow in place if nothing is mapped after it
+  acquire(&mmap_lock);
+  if(addr + newlen <= TRAPFRAME && tree_find(p, addr + oldlen, addr + newlen) == 0) {
+    ma->length = newlen;
+    grown = 1;
+  }
+  release(&mmap_lock);
+  if(grown)
+    return addr;
+
+  // move it to the first place it fits
+  if((nma = mmap_alloc()) == 0)
+    return 0;
+  *nma = *ma;
+  nma->length = newlen;
+  if(mmap_insert(p, nma, 1) < 0) {
+    kmem_cache_free(&mmap_cache, nma);
+    return 0;
+  }
+  if(uvmmove(p->pagetable, addr, nma->addr, oldlen / PGSIZE) < 0) {
+    acquire(&mmap_lock);
+    p->mmaps = tree_remove(p->mmaps, nma);
+    release(&mmap_lock);
+    kmem_cache_free(&mmap_cache, nma);
+    return 0;
+  }
+  if(nma->f)
+    filedup(nma->f);
+  mmap_remove(p, ma);
+  return nma->addr;
+}
+
 uint64
 sys_freemem(void)
 {
-  return freemem_count;
+  return freemem_count();
+}
+
+// Copy per-cache statistics of the kernel object caches
+// to a user array of up to n struct slabstat.
+// Returns the number of records copied, or -1.
+uint64
+sys_slabinfo(void)
+{
+  uint64 addr;
+  int n;
+  struct slabstat st[8];
+
+  argaddr(0, &addr);
+  argint(1, &n);
+  if(n < 0)
+    return -1;
+  if(n > NELEM(st))
+    n = NELEM(st);
+  n = slabstat(st, n);
+  if(copyout(myproc()->pagetable, addr, (char*)st, n * sizeof(st[0])) < 0)
+    return -1;
+  return n;
+}
+
+// Copy physical memory usage by category to a user struct memstat.
+// If sites is not 0, also copy up to n kalloc() call-site records
+// (only kept by kernels built with KALLOC_PROF).
+// Returns the number of call-site records copied, or -1.
+uint64
+sys_memstat(void)
+{
+  uint64 addr, sites;
+  int n;
+  struct memstat ms;
+  struct kallocsite *buf;
+
+  argaddr(0, &addr);
+  argaddr(1, &sites);
+  argint(2, &n);
+  if(n < 0)
+    return -1;
+
+  kmemstat(&ms);
+  ms.slab = slab_npages();
+  reclaimstat(&ms);
+  swapstat(&ms);
+  ms.nfault = nfault;
+  asidstat(&ms);
+  pagecachestat(&ms);
+  ms.zeromap = kpage_ref(zeropage) - 1;
+  if(copyout(myproc()->pagetable, addr, (char*)&ms, sizeof(ms)) < 0)
+    return -1;
+  if(sites == 0 || n == 0)
+    return 0;
+
+  // The table is too big for the kernel stack.
+  if((buf = kalloc()) == 0)
+    return -1;
+  if(n > PGSIZE / sizeof(*buf))
+    n = PGSIZE / sizeof(*buf);
+  n = kprof_sites(buf, n);
+  if(copyout(myproc()->pagetable, sites, (char*)buf, n * sizeof(*buf)) < 0)
+    n = -1;
+  kfree(buf);
+  return n;
 }
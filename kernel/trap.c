@@ -14,6 +14,7 @@
 
 struct spinlock tickslock;
 uint ticks;
+uint64 nfault;  // user page faults, for memstat
 
 extern char trampoline[], uservec[], userret[];
 
@@ -22,7 +23,71 @@ void kernelvec();
 
 extern int devintr();
 
-// Page fault handler for mmap regions
+// Map the page at va of p's area ma. A file page is the page
+// cache's page, unless a write to a private mapping needs its
+// own copy; private anonymous memory that is only read is the
+// shared zero page. The faulting page may wait for reclaim; a
+// neighbour is only mapped if a page is free.
+// Caller holds the file's inode lock for a file mapping.
+// Returns 0, or -1 if the page could not be mapped.
+static int
+mmap_map(struct proc *p, struct mmap_area *ma, uint64 va, int perm, int fault, int write)
+{
+  uint64 file_off = ma->offset + (va - ma->addr);
+  char *mem, *cpa = NULL;
+
+  if (!(ma->flags & MAP_ANONYMOUS)) {
+    cpa = pagecache_getlocked(ma->f->ip, file_off);
+    if (cpa == NULL && (ma->flags & MAP_SHARED))
+      return -1;
+  }
+
+  if ((ma->flags & MAP_ANONYMOUS) && !(ma->flags & MAP_SHARED) && !write) {
+    // Reading untouched anonymous memory: no page of its own yet
+    mem = zeropage;
+    kpage_get(mem);
+  } else if (cpa && ((ma->flags & MAP_SHARED) || !write)) {
+    // Shared file mapping: every process maps the page cache's
+    // page, so stores are seen by all and can be written back
+    mem = cpa;
+  } else {
+    // Allocate new physical page
+    if ((mem = fault ? kalloc_user() : kalloc_zeroed()) == NULL) {
+      if (cpa)
+        kpage_put(cpa);
+      return -1;
+    }
+    kpage_settype(mem, (ma->flags & MAP_ANONYMOUS) ? PG_ANON : PG_FILE);
+
+    // File mapping: copy the file's data, read directly if
+    // the page cache had no room for it
+    if (cpa) {
+      memmove(mem, cpa, PGSIZE);
+      kpage_put(cpa);
+    } else if (!(ma->flags & MAP_ANONYMOUS) &&
+               readi(ma->f->ip, 0, (uint64)mem, file_off, PGSIZE) < 0) {
+      kfree(mem);
+      return -1;
+    }
+  }
+
+  // A private area's first store to a page it shares gets a
+  // copy (see uvmcow())
+  if ((mem == zeropage || mem == cpa) && !(ma->flags & MAP_SHARED) && (perm & PTE_W))
+    perm = (perm & ~PTE_W) | PTE_COW;
+
+  if (mappages(p->pagetable, va, PGSIZE, (uint64)mem, perm) < 0) { // map page table
+    kpage_put(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Page fault handler for mmap regions.
+// A read fault maps the ma->around pages of the area around the
+// faulting one (an aligned window, so a sequential scan takes
+// one fault per window) that are not mapped yet, and flushes
+// the TLB once.
 static int
 handle_mmap_fault(uint64 fault_addr, uint64 scause)
 {
@@ -32,16 +97,7 @@ handle_mmap_fault(uint64 fault_addr, uint64 scause)
   // printf("handle_mmap_fault: addr=0x%lx scause=0x%lx\n", fault_addr, scause);
 
   // Find the valid mapping record that matches the fault address
-  for (int i = 0; i < MAX_MMAP_AREA; i++) {
-    if (mmap_areas[i].used && mmap_areas[i].p == p &&
-        fault_addr >= mmap_areas[i].addr &&
-        fault_addr < mmap_areas[i].addr + mmap_areas[i].length) {
-      ma = &mmap_areas[i];
-      // printf("handle_mmap_fault: found mapping at 0x%lx length=%d\n", 
-      //        ma->addr, ma->length);
-      break;
-    }
-  }
+  ma = mmap_find(p, fault_addr);
   if (ma == NULL) {
     // printf("handle_mmap_fault: no mapping found\n");
     return -1; // no mapping
@@ -63,34 +119,62 @@ handle_mmap_fault(uint64 fault_addr, uint64 scause)
     return 1;
   }
 
-  // Allocate new physical page
-  char *mem = kalloc();
-  if (mem == NULL) {
-    // printf("handle_mmap_fault: kalloc failed\n");
-    return -1;
+  int perm = PTE_U | PTE_R | ((ma->prot & PROT_WRITE) ? PTE_W : 0); // set PTE flag
+
+  // Private anonymous memory written to: map the whole 2MB
+  // around va at once if it lies inside the area
+  if ((ma->flags & MAP_ANONYMOUS) && !(ma->flags & MAP_SHARED) && scause == 15 &&
+      uvmmapmega(p->pagetable, va, ma->addr, ma->addr + ma->length, perm, PG_ANON) == 0) {
+    tlb_flush_page(p, va);
+    return 1;
   }
-  memset(mem, 0, PGSIZE); // fill with 0
 
-  // File mapping: read content from file
-  if (!(ma->flags & MAP_ANONYMOUS)) {
-    uint64 file_off = ma->offset + (va - ma->addr);
-    // printf("handle_mmap_fault: reading file offset=0x%lx\n", file_off);
-    if (readi(ma->f->ip, 0, (uint64)mem, file_off, PGSIZE) < 0) {
-      // printf("handle_mmap_fault: readi failed\n");
-      kfree(mem);
-      return -1;
-    }
+  // The window to map: just va for a write fault
+  uint64 lo = va, hi = va + PGSIZE;
+  if (scause == 13 && ma->around > 1) {
+    uint64 win = (uint64)ma->around * PGSIZE;
+    lo = va - (va - ma->addr) % win;
+    hi = lo + win;
+    if (hi > ma->addr + ma->length)
+      hi = ma->addr + ma->length;
   }
 
-  int perm = PTE_U | PTE_R | ((ma->prot & PROT_WRITE) ? PTE_W : 0); // set PTE flag
-  if (mappages(p->pagetable, va, PGSIZE, (uint64)mem, perm) < 0) { // map page table
-    // printf("handle_mmap_fault: mappages failed\n");
-    kfree(mem);
-    return -1;
+  // A file mapping reads all its pages under one lock, and
+  // into the page cache together
+  struct inode *ip = NULL;
+  if (!(ma->flags & MAP_ANONYMOUS)) {
+    ip = ma->f->ip;
+    ilock(ip);
+    if (hi - lo > PGSIZE)
+      pagecache_readahead(ip, ma->offset + (lo - ma->addr), (hi - lo) / PGSIZE);
   }
-  sfence_vma(); // TLB invalidation
-  // printf("handle_mmap_fault: mapped page at 0x%lx\n", va);
-  return 1;
+  int n = 0, r = 1;
+  for (uint64 a = lo; a < hi; a += PGSIZE) {
+    if (a != va) {
+      // skip pages mapped, swapped out or in a megapage
+      pte = walk(p->pagetable, a, 0);
+      if (pte && (*pte & (PTE_V | PTE_S)))
+        continue;
+    }
+    if (mmap_map(p, ma, a, perm, a == va, scause == 15) == 0) {
+      n++;
+    } else if (a == va) {
+      // printf("handle_mmap_fault: could not map 0x%lx\n", va);
+      r = -1;
+      break;
+    } else if (a > va) {
+      break;  // out of memory: leave the rest for later faults
+    }
+  }
+  if (ip)
+    iunlock(ip);
+
+  // TLB invalidation
+  if (n == 1)
+    tlb_flush_page(p, va);
+  else if (n > 1)
+    tlb_flush(p);
+  return r;
 }
 
 void
@@ -126,6 +210,9 @@ usertrap(void)
   // Save user PC
   p->trapframe->epc = r_sepc();
 
+  if (scause == 12 || scause == 13 || scause == 15)
+    __sync_fetch_and_add(&nfault, 1);
+
   if (scause == 8) {
     // syscall
     if (killed(p))
@@ -135,9 +222,12 @@ usertrap(void)
     syscall();
   } else if (devintr() != 0) {
     // device interrupt
-  } else if ((scause == 13 || scause == 15) &&
-             stval >= MMAPBASE && stval < MMAPBASE + 0x10000000UL) {
-    // mmap page fault
+  } else if ((scause == 12 || scause == 13 || scause == 15) &&
+             uvmfault(p->pagetable, stval, scause == 15) == 0) {
+    // page was an untouched heap page, swapped out or
+    // copy-on-write, and is fixed up; retry the access
+  } else if ((scause == 13 || scause == 15) && mmap_find(p, stval) != NULL) {
+    // mmap page fault; areas may lie anywhere up to TRAPFRAME
     int ret = handle_mmap_fault(stval, scause);
     if (ret == 1) {
       // handled: go to usertrapret for proper return
@@ -195,14 +285,17 @@ usertrapret(void)
   // set S Exception Program Counter to the saved user pc.
   w_sepc(p->trapframe->epc);
 
-  // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
+  // tell trampoline.S the user page table to switch to,
+  // tagged with this process's ASID on this hart.
+  int flush;
+  uint64 satp = asid_satp(p, &flush);
+  p->trapframe->kernel_flush = flush;
 
   // jump to userret in trampoline.S at the top of memory, which 
   // switches to the user page table, restores user registers,
   // and switches to user mode with sret.
   uint64 trampoline_userret = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64))trampoline_userret)(satp);
+  ((void (*)(uint64, uint64))trampoline_userret)(satp, flush);
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -220,12 +313,21 @@ kerneltrap()
   if(intr_get() != 0)
     panic("kerneltrap: interrupts enabled");
 
+  // The timer interrupt may yield. Tell reclaim() that this
+  // process may be halfway through copyin() or uvmunmap().
+  struct proc *p = myproc();
+  if(p)
+    p->kpreempted = 1;
+
   if((which_dev = devintr()) == 0){
     // interrupt or trap from an unknown source
     printf("scause=0x%lx sepc=0x%lx stval=0x%lx\n", scause, r_sepc(), r_stval());
     panic("kerneltrap");
   }
 
+  if(p)
+    p->kpreempted = 0;
+
 
   // the yield() may have caused some traps to occur,
   // so restore trap registers for use by kernelvec.S's sepc instruction.
@@ -7,10 +7,12 @@
 #include "fs.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "kalloc.h"
 #include <stdbool.h>
 
 #define PGSHIFT 12  // bits of offset within a page
 #define PGMASK (PGSIZE - 1)  // mask for page offset bits
+#define TLB_FLUSH_MAX 16     // flush a whole ASID rather than more pages than this
 
 // PTE flags
 #define PTE_V (1L << 0) // valid
@@ -29,59 +31,17 @@
 // All leaf mappings must already have been removed.
 void freewalk(pagetable_t pagetable);
 
-// ----------------------------------------------------------------------------
-// Recursively check if a subtree has no leaf PTEs (R/W/X bits)
-// Returns 1 if the subtree is completely empty of leaf mappings
-// Returns 0 if any leaf mapping is found
-// ----------------------------------------------------------------------------
-static int
-subtree_empty(pagetable_t pt)
-{
-  // Iterate through all 512 entries in the page table
-  for(int i = 0; i < 512; i++){
-    pte_t pte = pt[i];
-    if(!(pte & PTE_V))
-      continue;  // Skip if not valid (no mapping or table pointer)
-
-    // Check if this is a leaf mapping (has R/W/X bits)
-    if(pte & (PTE_R|PTE_W|PTE_X))
-      return 0;  // Found a leaf mapping, subtree is not empty
-
-    // This is a table pointer, recursively check the next level
-    pagetable_t child = (pagetable_t)PTE2PA(pte);
-    if(!subtree_empty(child))
-      return 0;  // Subtree contains leaf mappings
-  }
-  return 1;  // No leaf mappings found in this subtree
-}
+// Number of live PTEs, valid or swapped out, in the
+// page-table page that holds pte.
+#define PTLIVE(pte) (PA2PAGE(PGROUNDDOWN((uint64)(pte)))->nlive)
 
-// -----------------------------------------------------------------------------
-// Helper function: For the range va ~ va+npages*PGSIZE,
-// find Root→L1 entries where subtree_empty is true,
-// then free the page tables and clear the Root PTE
-// -----------------------------------------------------------------------------
+// Set up a newly allocated page as a page-table page
+// with nlive live PTEs.
 static void
-prune_pt(pagetable_t pagetable, uint64 start_va, uint64 npages)
-{
-  // Calculate the range of Level-2 indices to check
-  uint64 first = PX(2, start_va);
-  uint64 last  = PX(2, start_va + (npages-1)*PGSIZE);
-  for(uint64 idx = first; idx <= last; idx++){
-    pte_t *ptep2 = &pagetable[idx];
-    if(!(*ptep2 & PTE_V))
-      continue;  // Skip if no valid mapping
-
-    pagetable_t l1 = (pagetable_t)PTE2PA(*ptep2);
-    // Check if this subtree is completely empty of leaf mappings
-    if(!subtree_empty(l1))
-      continue;  // Skip if subtree still has leaf mappings
-
-    // Subtree is completely empty, free all page tables
-    freewalk(l1);  // Frees L1, L0 tables and the table itself
-
-    // Clear the Root PTE
-    *ptep2 = 0;
-  }
+ptinit(void *pt, int nlive)
+{
+  kpage_settype(pt, PG_PGTBL);
+  PA2PAGE(pt)->nlive = nlive;
 }
 
 /*
@@ -89,6 +49,11 @@ prune_pt(pagetable_t pagetable, uint64 start_va, uint64 npages)
  */
 pagetable_t kernel_pagetable;
 
+// A page of zeros, mapped read-only for reads of anonymous
+// memory nothing has written yet. It keeps one reference of its
+// own, so it is never freed.
+void *zeropage;
+
 extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
@@ -100,6 +65,7 @@ kvmmake(void)
   pagetable_t kpgtbl;
 
   kpgtbl = (pagetable_t) kalloc();
+  ptinit(kpgtbl, 0);
   memset(kpgtbl, 0, PGSIZE);
 
   // uart registers
@@ -115,6 +81,7 @@ kvmmake(void)
   kvmmap(kpgtbl, KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X);
 
   // map kernel data and the physical RAM we'll make use of.
+  // all but the first 2MB of it is mapped with megapages.
   kvmmap(kpgtbl, (uint64)etext, (uint64)etext, PHYSTOP-(uint64)etext, PTE_R | PTE_W);
 
   // map the trampoline for trap entry/exit to
@@ -132,6 +99,8 @@ void
 kvminit(void)
 {
   kernel_pagetable = kvmmake();
+  if((zeropage = kalloc_zeroed()) == 0)
+    panic("kvminit: zeropage");
 }
 
 // Switch h/w page table register to the kernel's page table,
@@ -146,6 +115,27 @@ kvminithart()
 
   // flush stale entries from the TLB.
   sfence_vma();
+
+  asidinit();
+}
+
+// Flush the current hart's TLB entries for npages pages at va
+// in pagetable, if it is the running process's page table.
+// Any other page table is new, being freed, or belongs to a
+// process the caller flushes with tlb_flush() itself.
+void
+uvmflush(pagetable_t pagetable, uint64 va, uint64 npages)
+{
+  struct proc *p = myproc();
+
+  if(p == 0 || p->pagetable != pagetable)
+    return;
+  if(npages > TLB_FLUSH_MAX){
+    tlb_flush(p);
+    return;
+  }
+  for(uint64 i = 0; i < npages; i++)
+    tlb_flush_page(p, va + i * PGSIZE);
 }
 
 // Return the address of the PTE in page table pagetable
@@ -160,6 +150,9 @@ kvminithart()
 //   21..29 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
+//
+// If va lies in a megapage, the level-1 leaf PTE that maps
+// the whole 2MB is returned; see walkmega().
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
 {
@@ -169,17 +162,50 @@ walk(pagetable_t pagetable, uint64 va, int alloc)
   for(int level = 2; level > 0; level--) {
     pte_t *pte = &pagetable[PX(level, va)];
     if(*pte & PTE_V) {
+      if(PTE_LEAF(*pte))
+        return pte;
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+      if(!alloc || (pagetable = (pde_t*)kalloc_zeroed()) == 0)
         return 0;
-      memset(pagetable, 0, PGSIZE);
+      ptinit(pagetable, 0);
       *pte = PA2PTE(pagetable) | PTE_V;
+      PTLIVE(pte)++;
     }
   }
   return &pagetable[PX(0, va)];
 }
 
+// Return the level-1 leaf PTE if va lies in a megapage,
+// or 0 if it is mapped with 4KB pages or not at all.
+pte_t *
+walkmega(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+
+  if(va >= MAXVA)
+    return 0;
+  pte = &pagetable[PX(2, va)];
+  if((*pte & PTE_V) == 0)
+    return 0;
+  pte = &((pagetable_t)PTE2PA(*pte))[PX(1, va)];
+  if((*pte & PTE_V) && PTE_LEAF(*pte))
+    return pte;
+  return 0;
+}
+
+// Physical address of the 4KB page at va, given the leaf
+// PTE that walk() returned for it.
+static uint64
+leafpa(pagetable_t pagetable, uint64 va, pte_t *pte)
+{
+  uint64 pa = PTE2PA(*pte);
+
+  if(walkmega(pagetable, va) == pte)
+    pa += PGROUNDDOWN(va) & (MEGAPGSIZE - 1);
+  return pa;
+}
+
 // Look up a virtual address, return the physical address,
 // or 0 if not mapped.
 // Can only be used to look up user pages.
@@ -199,18 +225,66 @@ walkaddr(pagetable_t pagetable, uint64 va)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
-  pa = PTE2PA(*pte);
+  pa = leafpa(pagetable, va, pte);
   return pa;
 }
 
 // add a mapping to the kernel page table.
 // only used when booting.
 // does not flush TLB or enable paging.
+// the 2MB-aligned parts of the range get megapages.
 void
 kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 {
-  if(mappages(kpgtbl, va, sz, pa, perm) != 0)
-    panic("kvmmap");
+  uint64 n;
+
+  while(sz > 0){
+    if(va % MEGAPGSIZE == 0 && pa % MEGAPGSIZE == 0 && sz >= MEGAPGSIZE){
+      n = MEGAPGSIZE;
+      if(mapmega(kpgtbl, va, pa, perm) != 0)
+        panic("kvmmap");
+    } else {
+      n = MEGAPGSIZE - va % MEGAPGSIZE;
+      if(n > sz)
+        n = sz;
+      if(mappages(kpgtbl, va, n, pa, perm) != 0)
+        panic("kvmmap");
+    }
+    va += n;
+    pa += n;
+    sz -= n;
+  }
+}
+
+// Map the 2MB at va to the 2MB of physical memory at pa
+// with one level-1 leaf PTE. va and pa MUST be 2MB-aligned.
+// Returns 0 on success, -1 if the level-1 page-table page
+// couldn't be allocated.
+int
+mapmega(pagetable_t pagetable, uint64 va, uint64 pa, int perm)
+{
+  pagetable_t l1;
+  pte_t *pte;
+
+  if(va % MEGAPGSIZE != 0 || pa % MEGAPGSIZE != 0)
+    panic("mapmega: not aligned");
+
+  pte = &pagetable[PX(2, va)];
+  if(*pte & PTE_V){
+    l1 = (pagetable_t)PTE2PA(*pte);
+  } else {
+    if((l1 = (pagetable_t)kalloc_zeroed()) == 0)
+      return -1;
+    ptinit(l1, 0);
+    *pte = PA2PTE(l1) | PTE_V;
+    PTLIVE(pte)++;
+  }
+  pte = &l1[PX(1, va)];
+  if(*pte & PTE_V)
+    panic("mapmega: remap");
+  *pte = PA2PTE(pa) | perm | PTE_V;
+  PTLIVE(pte)++;
+  return 0;
 }
 
 // Create PTEs for virtual addresses starting at va that refer to
@@ -238,9 +312,10 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   for(;;){
     if((pte = walk(pagetable, a, 1)) == 0)
       return -1;
-    if(*pte & PTE_V)
+    if(*pte & (PTE_V|PTE_S))
       panic("mappages: remap");
     *pte = PA2PTE(pa) | perm | PTE_V;
+    PTLIVE(pte)++;
     if(a == last)
       break;
     a += PGSIZE;
@@ -249,10 +324,33 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   return 0;
 }
 
+// Clear the live PTE for va at level (0, or 1 for a megapage).
+// A page-table page left with no live PTEs is freed on the
+// spot, and the PTE that pointed to it cleared in turn; the
+// root is kept until freewalk().
+void
+uvmclearpte(pagetable_t pagetable, uint64 va, int level)
+{
+  pagetable_t pt[3];
+
+  pt[2] = pagetable;
+  for(int l = 2; l > level; l--)
+    pt[l-1] = (pagetable_t)PTE2PA(pt[l][PX(l, va)]);
+  for(; level <= 2; level++){
+    struct page *pg = PA2PAGE(pt[level]);
+    if(pg->nlive == 0)
+      panic("uvmclearpte");
+    pt[level][PX(level, va)] = 0;
+    if(--pg->nlive > 0 || level == 2)
+      break;
+    kfree(pt[level]);
+  }
+}
+
 // -----------------------------------------------------------------------------
 // uvmunmap: Unmap pages in the range va ~ va+npages*PGSIZE
 // If do_free is 1, also free the physical pages
-// Then clean up empty page tables using prune_pt
+// Page-table pages are freed as they become empty
 // -----------------------------------------------------------------------------
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
@@ -262,27 +360,41 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 
   // 1) Free leaf PTEs (data pages)
   for(uint64 a = va; a < va + npages*PGSIZE; a += PGSIZE){
-    pte_t *pte = walk(pagetable, a, 0);
+    pte_t *pte = walkmega(pagetable, a);
+    if(pte){
+      if(a % MEGAPGSIZE == 0 && a + MEGAPGSIZE <= va + npages*PGSIZE){
+        // The whole megapage goes; its pages are freed one by one.
+        if(do_free)
+          for(uint64 off = 0; off < MEGAPGSIZE; off += PGSIZE)
+            kpage_put((void*)(PTE2PA(*pte) + off));
+        uvmclearpte(pagetable, a, 1);
+        a += MEGAPGSIZE - PGSIZE;
+        continue;
+      }
+      // Only part of it goes; split it into 4KB PTEs first.
+      if(uvmsplit(pagetable, a) != 0)
+        panic("uvmunmap: split");
+    }
+    pte = walk(pagetable, a, 0);
+    if(pte && (*pte & PTE_S)){
+      if(do_free)
+        swap_free(PTE2SLOT(*pte));  // Page lives in swap
+      uvmclearpte(pagetable, a, 0);
+      continue;
+    }
     if(pte == 0 || !(*pte & PTE_V))
       continue;  // Skip if no valid mapping
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");  // Must be a leaf mapping
 
-    if(do_free){
-      uint64 pa = PTE2PA(*pte);
-      memset((void*)pa, 1, PGSIZE);  // Prevent dangling pointers
-      kfree((void*)pa);              // Free the physical page
-    }
-    *pte = 0;  // Clear the PTE
+    if(do_free)
+      kpage_put((void*)PTE2PA(*pte));  // Drop this mapping's reference
+    uvmclearpte(pagetable, a, 0);  // Clear the PTE
   }
 
-  if(do_free){
-    // 2) Clean up empty page tables
-    prune_pt(pagetable, va, npages);
-
-    // 3) Flush TLB to ensure changes take effect
-    sfence_vma();
-  }
+  // 2) Flush TLB to ensure changes take effect
+  if(do_free)
+    uvmflush(pagetable, va, npages);
 }
 
 // create an empty user page table.
@@ -291,10 +403,10 @@ pagetable_t
 uvmcreate()
 {
   pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
+  pagetable = (pagetable_t) kalloc_zeroed();
   if(pagetable == 0)
     return 0;
-  memset(pagetable, 0, PGSIZE);
+  ptinit(pagetable, 0);
   return pagetable;
 }
 
@@ -309,6 +421,7 @@ uvmfirst(pagetable_t pagetable, uchar *src, uint sz)
   if(sz >= PGSIZE)
     panic("uvmfirst: more than a page");
   mem = kalloc();
+  kpage_settype(mem, PG_ANON);
   memset(mem, 0, PGSIZE);
   mappages(pagetable, 0, PGSIZE, (uint64)mem, PTE_W|PTE_R|PTE_X|PTE_U);
   memmove(mem, src, sz);
@@ -327,12 +440,12 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 
   oldsz = PGROUNDUP(oldsz);
   for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kalloc_user();
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
+    kpage_settype(mem, PG_ANON);
     if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_R|PTE_U|xperm) != 0){
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
@@ -373,7 +486,7 @@ freewalk(pagetable_t pagetable)
       pagetable_t child = (pagetable_t)PTE2PA(pte);
       freewalk(child);
       pagetable[i] = 0;
-    } else if(pte & PTE_V){
+    } else if(pte & (PTE_V|PTE_S)){
       // leaf가 남아 있으면 안 됨
       panic("freewalk: leaf");
     }
@@ -394,32 +507,37 @@ uvmfree(pagetable_t pagetable, uint64 sz)
 
 // Given a parent process's page table, copy
 // its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// Copies the page table; the physical pages are
+// shared copy-on-write (see uvmshare()).
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
+// the caller must flush old's TLB entries with tlb_flush(),
+// since old's PTEs change.
 int
 uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
 {
   pte_t *pte;
-  uint64 pa, i;
-  uint flags;
-  char *mem;
+  uint64 i;
 
   for(i = 0; i < sz; i += PGSIZE){
+    if((pte = walkmega(old, i)) != 0){
+      if(uvmshare(pte, new, i, MEGAPGSIZE) != 0)
+        goto err;
+      i += MEGAPGSIZE - PGSIZE;
+      continue;
+    }
     if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
+      continue;   // heap page not touched yet
+    if(*pte & PTE_S){
+      // Share the swap slot; each copy is read back on its own.
+      if(uvmcopyswap(new, i, *pte) != 0)
+        goto err;
+      continue;
+    }
     if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
-    pa = PTE2PA(*pte);
-    flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
+      continue;
+    if(uvmshare(pte, new, i, PGSIZE) != 0)
       goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
-      goto err;
-    }
   }
   return 0;
 
@@ -428,6 +546,388 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
   return -1;
 }
 
+// Move the user pages in [from, from+npages*PGSIZE) that are
+// mapped or swapped out to the same place in [to, ...), which
+// must have none, without copying them. Megapages are split
+// first. Flushes the TLB.
+// Returns 0 on success, or -1 if a page-table page could not be
+// allocated; then nothing has moved, though page-table pages
+// allocated for to may stay, empty, until they are used.
+int
+uvmmove(pagetable_t pagetable, uint64 from, uint64 to, uint64 npages)
+{
+  pte_t *pte, *npte;
+  uint64 a;
+
+  // Allocate everything first, so that the move can't fail.
+  for(a = 0; a < npages * PGSIZE; a += PGSIZE){
+    if(walkmega(pagetable, from + a) && uvmsplit(pagetable, from + a) != 0)
+      return -1;
+    pte = walk(pagetable, from + a, 0);
+    if(pte && (*pte & (PTE_V|PTE_S)) && walk(pagetable, to + a, 1) == 0)
+      return -1;
+  }
+
+  for(a = 0; a < npages * PGSIZE; a += PGSIZE){
+    pte = walk(pagetable, from + a, 0);
+    if(pte == 0 || (*pte & (PTE_V|PTE_S)) == 0)
+      continue;
+    npte = walk(pagetable, to + a, 0);
+    if(*npte & (PTE_V|PTE_S))
+      panic("uvmmove: remap");
+    *npte = *pte;
+    PTLIVE(npte)++;
+    uvmclearpte(pagetable, from + a, 0);
+  }
+  uvmflush(pagetable, from, npages);
+  return 0;
+}
+
+// The PTE pte with write permission given or taken away. A
+// resident page that private is set for and that is shared with
+// another mapping becomes copy-on-write instead of writable.
+static pte_t
+protect(pte_t pte, int write, int private)
+{
+  pte &= ~(PTE_W | PTE_COW);
+  if(!write)
+    return pte;
+  if(private && (pte & PTE_V) && kpage_ref((void*)PTE2PA(pte)) > 1)
+    return pte | PTE_COW;
+  return pte | PTE_W;
+}
+
+// Make the user pages in [va, va+npages*PGSIZE) that are mapped
+// or swapped out writable if write is set, else read-only.
+// private is set for memory that stores must not reach other
+// mappings through (see protect()). A megapage that is only
+// partly in the range is split. Flushes the TLB.
+// Returns 0 on success, -1 if a megapage could not be split.
+int
+uvmprotect(pagetable_t pagetable, uint64 va, uint64 npages, int write, int private)
+{
+  uint64 end = va + npages * PGSIZE;
+  pte_t *pte;
+  int r = 0;
+
+  for(uint64 a = va; a < end; a += PGSIZE){
+    if((pte = walkmega(pagetable, a)) != 0){
+      if(a % MEGAPGSIZE == 0 && a + MEGAPGSIZE <= end){
+        *pte = protect(*pte, write, private);
+        a += MEGAPGSIZE - PGSIZE;
+        continue;
+      }
+      if(uvmsplit(pagetable, a) != 0){
+        r = -1;
+        break;
+      }
+    }
+    pte = walk(pagetable, a, 0);
+    if(pte && (*pte & (PTE_V|PTE_S)))
+      *pte = protect(*pte, write, private);
+  }
+  uvmflush(pagetable, va, npages);
+  return r;
+}
+
+// Map the page that *pte maps into new at va as well,
+// taking a reference to each of its 4KB pages. size is
+// PGSIZE, or MEGAPGSIZE for a megapage. A writable page
+// becomes read-only and PTE_COW in both page tables, so that
+// the first write to it in either gets a private copy from
+// uvmcow(). Returns 0 on success, -1 if a page-table page
+// could not be allocated.
+int
+uvmshare(pte_t *pte, pagetable_t new, uint64 va, uint64 size)
+{
+  uint64 pa = PTE2PA(*pte), off;
+  int r;
+
+  if(*pte & PTE_W)
+    *pte = (*pte & ~PTE_W) | PTE_COW;
+  for(off = 0; off < size; off += PGSIZE)
+    kpage_get((void*)(pa + off));
+  if(size == MEGAPGSIZE)
+    r = mapmega(new, va, pa, PTE_FLAGS(*pte));
+  else
+    r = mappages(new, va, PGSIZE, pa, PTE_FLAGS(*pte));
+  if(r != 0){
+    for(off = 0; off < size; off += PGSIZE)
+      kpage_put((void*)(pa + off));
+    return -1;
+  }
+  return 0;
+}
+
+// Replace the megapage PTE covering va, if there is one, by
+// a page-table page of 4KB PTEs for the same physical pages
+// and with the same flags. May be called with a spinlock
+// held, but can then only take pages that are already free.
+// Returns 0 on success, -1 if there is no memory for the
+// page-table page.
+int
+uvmsplit(pagetable_t pagetable, uint64 va)
+{
+  pagetable_t l0;
+  pte_t *pte;
+  uint64 pa;
+  int flags;
+
+  if(walkmega(pagetable, va) == 0)
+    return 0;
+  if((l0 = (pagetable_t)(holdingany() ? kalloc_zeroed() : kalloc_user())) == 0)
+    return -1;
+  // kalloc_user() may have reclaimed, and split, the megapage.
+  if((pte = walkmega(pagetable, va)) == 0){
+    kfree(l0);
+    return 0;
+  }
+  ptinit(l0, MEGAPGSIZE / PGSIZE);
+  pa = PTE2PA(*pte);
+  flags = PTE_FLAGS(*pte);
+  for(int i = 0; i < MEGAPGSIZE / PGSIZE; i++)
+    l0[i] = PA2PTE(pa + i * PGSIZE) | flags;
+  *pte = PA2PTE(l0) | PTE_V;
+  uvmflush(pagetable, MEGAPGROUNDDOWN(va), 1);
+  return 0;
+}
+
+// Map the 2MB-aligned block around va with one zeroed
+// megapage of pages of the given type, if the block lies
+// within [lo, hi), nothing in it is mapped yet, and a 2MB
+// physical block can be had without going below the reclaim
+// watermark. Returns 0 if it did, -1 if the caller should
+// map a 4KB page instead.
+int
+uvmmapmega(pagetable_t pagetable, uint64 va, uint64 lo, uint64 hi, int perm, int type)
+{
+  uint64 base = MEGAPGROUNDDOWN(va);
+  pte_t *pte;
+  char *mem;
+
+  if(base < lo || base + MEGAPGSIZE > hi || base + MEGAPGSIZE > MAXVA)
+    return -1;
+  pte = &pagetable[PX(2, base)];
+  if((*pte & PTE_V) && (((pagetable_t)PTE2PA(*pte))[PX(1, base)] & PTE_V))
+    return -1;
+  if(freemem_count() < KMEM_LOW + MEGAPGSIZE / PGSIZE)
+    return -1;
+  if((mem = kalloc_pages(MEGAORDER)) == 0)
+    return -1;
+  memset(mem, 0, MEGAPGSIZE);
+  for(uint64 off = 0; off < MEGAPGSIZE; off += PGSIZE)
+    kpage_settype(mem + off, type);
+  if(mapmega(pagetable, base, (uint64)mem, perm) != 0){
+    kfree_pages(mem, MEGAORDER);
+    return -1;
+  }
+  return 0;
+}
+
+// Give the copy-on-write page at va a private, writable
+// copy. The last user of a shared page keeps it and only
+// gets PTE_W back. May be called with a spinlock held, but
+// can then only take pages that are already free.
+// Returns 0 on success, or if reclaim took the page while
+// the copy was being allocated, so that the access faults
+// again; -1 if va is not a copy-on-write page or there is no
+// memory.
+int
+uvmcow(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  uint64 pa;
+  char *mem;
+  int i, retry = 0;
+
+  if(va >= MAXVA)
+    return -1;
+  if((pte = walkmega(pagetable, va)) != 0 && (*pte & PTE_COW)){
+    // Keep the megapage if no other process maps any of it.
+    pa = PTE2PA(*pte);
+    for(i = 0; i < MEGAPGSIZE / PGSIZE; i++)
+      if(kpage_ref((void*)(pa + i * PGSIZE)) != 1)
+        break;
+    if(i == MEGAPGSIZE / PGSIZE){
+      *pte = (*pte & ~PTE_COW) | PTE_W;
+      uvmflush(pagetable, MEGAPGROUNDDOWN(va), 1);
+      return 0;
+    }
+    if(uvmsplit(pagetable, va) < 0)
+      return -1;
+  }
+again:
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_COW) == 0)
+    return retry ? 0 : -1;
+  pa = PTE2PA(*pte);
+  if(kpage_ref((void*)pa) == 1){
+    *pte = (*pte & ~PTE_COW) | PTE_W;
+  } else {
+    if((mem = holdingany() ? kalloc() : kalloc_user()) == 0)
+      return -1;
+    // kalloc_user() may have reclaimed the page, and freed the
+    // page-table page pte points into; look again.
+    pte = walk(pagetable, va, 0);
+    if(pte == 0 || (*pte & (PTE_V|PTE_COW)) != (PTE_V|PTE_COW) || PTE2PA(*pte) != pa){
+      kfree(mem);
+      retry = 1;
+      goto again;
+    }
+    kpage_settype(mem, (void*)pa == zeropage ? PG_ANON : PA2PAGE(pa)->type);
+    memmove(mem, (char*)pa, PGSIZE);
+    *pte = PA2PTE(mem) | (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+    kpage_put((void*)pa);
+  }
+  uvmflush(pagetable, PGROUNDDOWN(va), 1);
+  return 0;
+}
+
+// Map the page at va if va is in the current process's
+// memory but has not been touched yet: read it in if it is in
+// a program segment (see execfault()), or else map a zeroed heap
+// page, using a megapage if the whole 2MB around va is untouched
+// heap. May be called with a spinlock held, but can then only
+// take pages that are already free, and not read any in.
+// Returns 0 on success, -1 if va is outside the process's
+// memory, already mapped, or there is no memory.
+int
+uvmlazy(pagetable_t pagetable, uint64 va)
+{
+  struct proc *p = myproc();
+  uint64 lo = 0;
+  pte_t *pte;
+  char *mem;
+  int r;
+
+  va = PGROUNDDOWN(va);
+  if(p == 0 || pagetable != p->pagetable || va >= p->sz)
+    return -1;
+  pte = walk(pagetable, va, 0);
+  if(pte && (*pte & (PTE_V|PTE_S)))
+    return -1;
+  if((r = execfault(p, va)) <= 0)
+    return r;
+
+  // The heap starts above the program segments.
+  for(int i = 0; i < p->nseg; i++)
+    if(p->seg[i].va + p->seg[i].memsz > lo)
+      lo = PGROUNDUP(p->seg[i].va + p->seg[i].memsz);
+  if(uvmmapmega(pagetable, va, lo, p->sz, PTE_R|PTE_W|PTE_U, PG_ANON) == 0)
+    return 0;
+  if((mem = holdingany() ? kalloc_zeroed() : kalloc_user()) == 0)
+    return -1;
+  kpage_settype(mem, PG_ANON);
+  if(mappages(pagetable, va, PGSIZE, (uint64)mem, PTE_R|PTE_W|PTE_U) != 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Make the user page at va accessible after a fault or a
+// failed copyin()/copyout(): map it if it is an untouched
+// heap page, swap it back in if it was swapped out, and
+// break copy-on-write sharing if write is set. Returns 0 if
+// the page was fixed up, -1 if there was nothing to fix or
+// no memory. Must not be called with a spinlock held.
+int
+uvmfault(pagetable_t pagetable, uint64 va, int write)
+{
+  pte_t *pte;
+  int fixed = 0;
+
+  va = PGROUNDDOWN(va);
+  if(va >= MAXVA)
+    return -1;
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & (PTE_V|PTE_S)) == 0)
+    return uvmlazy(pagetable, va);
+  if(*pte & PTE_S){
+    if(swapin(pagetable, va) < 0)
+      return -1;
+    fixed = 1;
+  }
+  if(write && (*pte & PTE_COW)){
+    if(uvmcow(pagetable, va) < 0)
+      return -1;
+    fixed = 1;
+  }
+  return fixed ? 0 : -1;
+}
+
+// Give the page table new a copy of the swapped-out PTE
+// for va, taking another reference to its swap slot.
+// Returns 0 on success, -1 if a page-table page
+// could not be allocated.
+int
+uvmcopyswap(pagetable_t new, uint64 va, pte_t pte)
+{
+  pte_t *npte;
+
+  if((npte = walk(new, va, 1)) == 0)
+    return -1;
+  if(*npte & (PTE_V|PTE_S))
+    panic("uvmcopyswap: remap");
+  swap_dup(PTE2SLOT(pte));
+  *npte = pte;
+  PTLIVE(npte)++;
+  return 0;
+}
+
+// Find the physical address of the user page at va for
+// copyin() or copyout(), first mapping it if it is an
+// untouched heap page, bringing it back from swap if it
+// was swapped out, and giving it a private copy if it is
+// copy-on-write and write is set. Swapping in sleeps, so
+// the caller must not hold a spinlock for that; instead the
+// copy fails and the caller can drop its locks and call
+// uvmfault() itself.
+// Returns 0 if the page is not accessible.
+static uint64
+uvmlookup(pagetable_t pagetable, uint64 va, int write)
+{
+  pte_t *pte;
+
+  if(va >= MAXVA)
+    return 0;
+  pte = walk(pagetable, va, 0);
+  if((pte == 0 || (*pte & (PTE_V|PTE_S)) == 0) && uvmlazy(pagetable, va) == 0)
+    pte = walk(pagetable, va, 0);
+  if(pte && (*pte & PTE_S) && !holdingany()){
+    if(swapin(pagetable, va) < 0)
+      return 0;
+  }
+  if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0)
+    return 0;
+  if(write && (*pte & PTE_COW)){
+    if(uvmcow(pagetable, va) < 0)
+      return 0;
+    pte = walk(pagetable, va, 0);  // a megapage may have been split
+    if(pte == 0 || (*pte & PTE_V) == 0)
+      return uvmlookup(pagetable, va, write);  // reclaim took it
+  }
+  if(write){
+    if((*pte & PTE_W) == 0)
+      return 0;
+    *pte |= PTE_A | PTE_D;  // as the MMU would, for msync() and reclaim
+  }
+  return leafpa(pagetable, va, pte);
+}
+
+// Fault in the user pages of [va, va+n), and make them
+// writable if write is set, for a copy that will be done
+// holding a sleep-lock, when execfault() can't read program
+// pages in. Returns 0, or -1 if a page is not accessible.
+int
+uvmprefault(pagetable_t pagetable, uint64 va, uint64 n, int write)
+{
+  for(uint64 a = PGROUNDDOWN(va); a < va + n; a += PGSIZE)
+    if(uvmlookup(pagetable, a, write) == 0)
+      return -1;
+  return 0;
+}
+
 // mark a PTE invalid for user access.
 // used by exec for the user stack guard page.
 void
@@ -448,17 +948,11 @@ int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
-  pte_t *pte;
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    if(va0 >= MAXVA)
+    if((pa0 = uvmlookup(pagetable, va0, 1)) == 0)
       return -1;
-    pte = walk(pagetable, va0, 0);
-    if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0 ||
-       (*pte & PTE_W) == 0)
-      return -1;
-    pa0 = PTE2PA(*pte);
     n = PGSIZE - (dstva - va0);
     if(n > len)
       n = len;
@@ -481,8 +975,7 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if((pa0 = uvmlookup(pagetable, va0, 0)) == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
     if(n > len)
@@ -508,26 +1001,20 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if((pa0 = uvmlookup(pagetable, va0, 0)) == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
     if(n > max)
       n = max;
 
     char *p = (char *) (pa0 + (srcva - va0));
-    while(n > 0){
-      if(*p == '\0'){
-        *dst = '\0';
-        got_null = 1;
-        break;
-      } else {
-        *dst = *p;
-      }
-      --n;
-      --max;
-      p++;
-      dst++;
+    uint64 len = strnlen(p, n);
+    memmove(dst, p, len);
+    dst += len;
+    max -= len;
+    if(len < n){
+      *dst = '\0';
+      got_null = 1;
     }
 
     srcva = va0 + PGSIZE;
@@ -0,0 +1,88 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/memstat.h"
+#include "user/user.h"
+
+// Print physical memory usage by category, page reclaim activity,
+// the number of page faults, page-cache sharing and mappings
+// of the shared zero page.
+// With -s, also print the kalloc() call sites with the most
+// pages still outstanding (kernel must be built with
+// KALLOC_PROF=1). Map the addresses to source lines with
+// addr2line -e kernel/kernel.
+
+#define NSITES 64
+
+static struct kallocsite sites[NSITES];
+
+static void
+row(char *name, uint64 npages)
+{
+  printf("%s\t%lu\t%lu KB\n", name, npages, npages * 4);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct memstat ms;
+  int sflag = 0, n;
+
+  if(argc == 2 && strcmp(argv[1], "-s") == 0)
+    sflag = 1;
+  else if(argc != 1){
+    fprintf(2, "usage: memstat [-s]\n");
+    exit(1);
+  }
+
+  if((n = memstat(&ms, sflag ? sites : 0, NSITES)) < 0){
+    fprintf(2, "memstat: failed\n");
+    exit(1);
+  }
+
+  printf("type\tpages\tsize\n");
+  row("total", ms.total);
+  row("free", ms.free);
+  row("zeroed", ms.zeroed);
+  row("kernel", ms.kernel);
+  row("slab", ms.slab);
+  row("anon", ms.anon);
+  row("file", ms.file);
+  row("pgtbl", ms.pgtbl);
+  row("kstack", ms.kstack);
+  row("pipe", ms.pipe);
+
+  int t = uptime();
+  printf("\nreclaim: %lu runs, %lu pages scanned (%lu per 100 ticks), %lu evicted\n",
+         ms.nreclaimrun, ms.nscan, t > 0 ? ms.nscan * 100 / t : 0, ms.nreclaim);
+  printf("swap: %lu of %lu pages used, %lu swapped in, %lu swapped out\n",
+         ms.swapused, ms.swaptotal, ms.nswapin, ms.nswapout);
+  printf("faults: %lu page faults\n", ms.nfault);
+  printf("page cache: %lu pages, %lu copies saved by sharing, %lu hits, %lu misses\n",
+         ms.pcache, ms.pcsaved, ms.pchit, ms.pcmiss);
+  printf("zero page: %lu mappings\n", ms.zeromap);
+  if(ms.asids)
+    printf("asids: %lu per hart, %lu rollovers\n", ms.asids, ms.nasidroll);
+  else
+    printf("asids: none; the TLB is flushed on every switch\n");
+
+  if(!sflag)
+    exit(0);
+  if(n == 0){
+    printf("no call sites recorded; build the kernel with KALLOC_PROF=1\n");
+    exit(0);
+  }
+
+  // Sort by outstanding pages, largest first.
+  for(int i = 1; i < n; i++){
+    struct kallocsite s = sites[i];
+    int j;
+    for(j = i; j > 0 && sites[j-1].nalloc - sites[j-1].nfree < s.nalloc - s.nfree; j--)
+      sites[j] = sites[j-1];
+    sites[j] = s;
+  }
+  printf("\ncaller\t\t\tallocs\tfrees\tlive\n");
+  for(int i = 0; i < n; i++)
+    printf("0x%lx\t%lu\t%lu\t%lu\n", sites[i].pc, sites[i].nalloc,
+           sites[i].nfree, sites[i].nalloc - sites[i].nfree);
+  exit(0);
+}
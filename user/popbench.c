@@ -0,0 +1,101 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/memstat.h"
+#include "user/user.h"
+
+// MAP_POPULATE benchmark: map a file with MAP_POPULATE and
+// unmap it, over and over, and report the throughput.
+//
+// cold: the file is closed between rounds, so its pages leave
+//       the page cache and every round reads them from disk.
+// warm: another descriptor keeps the pages cached, so each
+//       round only maps them.
+//
+// A tick is 1/10 second under qemu.
+
+#define PGSIZE         4096
+#define PROT_READ      0x1
+#define MAP_POPULATE   0x2
+
+#define FILE           "popbench.dat"
+#define NPAGES         32
+#define NROUND         80
+
+static void
+make_file(void)
+{
+  char buf[PGSIZE];
+  int fd;
+
+  unlink(FILE);
+  if((fd = open(FILE, O_CREATE | O_RDWR)) < 0){
+    fprintf(2, "popbench: create failed\n");
+    exit(1);
+  }
+  for(int n = 0; n < NPAGES; n++){
+    memset(buf, n, PGSIZE);
+    if(write(fd, buf, PGSIZE) != PGSIZE){
+      fprintf(2, "popbench: write failed\n");
+      exit(1);
+    }
+  }
+  close(fd);
+}
+
+static int
+bench(void)
+{
+  int t0 = uptime();
+
+  for(int r = 0; r < NROUND; r++){
+    int fd = open(FILE, O_RDONLY);
+    char *m = (char*)mmap(0, NPAGES * PGSIZE, PROT_READ, MAP_POPULATE, fd, 0);
+    if(fd < 0 || m == 0){
+      fprintf(2, "popbench: mmap failed\n");
+      exit(1);
+    }
+    if(m[(NPAGES - 1) * PGSIZE] != NPAGES - 1){
+      fprintf(2, "popbench: wrong data\n");
+      exit(1);
+    }
+    munmap((uint64)m);
+    close(fd);
+  }
+  return uptime() - t0;
+}
+
+static void
+report(char *name, int ticks, uint64 faults)
+{
+  uint64 kb = (uint64)NROUND * NPAGES * PGSIZE / 1024;
+
+  if(ticks == 0)
+    ticks = 1;
+  printf("%s: %lu KB in %d ticks, %lu KB/s (%lu MB/s), %lu faults\n",
+         name, kb, ticks, kb * 10 / ticks, kb * 10 / ticks / 1024, faults);
+}
+
+int
+main(void)
+{
+  struct memstat before, after;
+  int t, fd;
+
+  make_file();
+
+  memstat(&before, 0, 0);
+  t = bench();
+  memstat(&after, 0, 0);
+  report("cold", t, after.nfault - before.nfault);
+
+  fd = open(FILE, O_RDONLY);
+  memstat(&before, 0, 0);
+  t = bench();
+  memstat(&after, 0, 0);
+  report("warm", t, after.nfault - before.nfault);
+  close(fd);
+
+  unlink(FILE);
+  exit(0);
+}
@@ -0,0 +1,26 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/memstat.h"
+#include "user/user.h"
+
+// Print usage and hit statistics of the kernel object caches.
+int
+main(int argc, char *argv[])
+{
+  struct slabstat st[8];
+  int n;
+
+  if((n = slabinfo(st, 8)) < 0){
+    fprintf(2, "slabinfo: failed\n");
+    exit(1);
+  }
+
+  printf("cache\t\tobjsize\tperslab\tslabs\tactive\tallocs\thits\n");
+  for(int i = 0; i < n; i++){
+    printf("%s\t%s%d\t%d\t%d\t%d\t%lu\t%lu\n",
+           st[i].name, strlen(st[i].name) < 8 ? "\t" : "",
+           st[i].objsize, st[i].perslab, st[i].nslabs, st[i].active,
+           st[i].nalloc, st[i].nhit);
+  }
+  exit(0);
+}
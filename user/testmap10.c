@@ -0,0 +1,119 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/memstat.h"
+#include "user.h"
+
+#define PGSIZE         4096
+#define MEGAPGSIZE     (PGSIZE * 512)
+#define PROT_READ      0x1
+#define PROT_WRITE     0x2
+#define MAP_ANONYMOUS  0x1
+#define MAP_POPULATE   0x2
+
+#define MAPSIZE        (64 * 1024 * 1024)
+#define HEAPSIZE       (8 * 1024 * 1024)
+
+void check(int cond, char *msg) {
+  if (!cond) {
+    printf("FAIL: %s\n", msg);
+    exit(1);
+  }
+}
+
+// Touch every page of a large anonymous mapping. With megapages
+// that takes one fault and no level-0 page-table page per 2MB.
+void test_mega_mmap() {
+  printf("\n[1] 64MB anonymous mmap\n");
+  struct memstat before, after;
+  int npages = MAPSIZE / PGSIZE;
+
+  check(memstat(&before, 0, 0) >= 0, "memstat");
+  int *m = (int*)mmap(0, MAPSIZE, PROT_READ | PROT_WRITE, MAP_ANONYMOUS, -1, 0);
+  check(m != 0, "mmap");
+  for (int i = 0; i < npages; i++)
+    m[i * PGSIZE / sizeof(int)] = i;
+  check(memstat(&after, 0, 0) >= 0, "memstat");
+
+  uint64 faults = after.nfault - before.nfault;
+  uint64 pgtbl = after.pgtbl - before.pgtbl;
+  printf("%d pages touched: %lu faults, %lu page-table pages\n", npages, faults, pgtbl);
+  check(faults < npages / 8, "too many faults; no megapages?");
+  check(pgtbl < npages / 512 / 2, "too many page-table pages; no megapages?");
+
+  for (int i = 0; i < npages; i++)
+    check(m[i * PGSIZE / sizeof(int)] == i, "data lost");
+  check(munmap((uint64)m) == 1, "munmap");
+  check(memstat(&after, 0, 0) >= 0, "memstat");
+  check(after.anon <= before.anon, "megapages not freed");
+}
+
+// A heap that grows by whole megapages, then shrinks to the
+// middle of one, which must split it.
+void test_mega_heap() {
+  printf("\n[2] 8MB heap\n");
+  struct memstat before, after;
+  int npages = HEAPSIZE / PGSIZE;
+
+  // Start the heap on a 2MB boundary; the pad is never touched.
+  uint64 top = (uint64)sbrk(0);
+  int pad = ((top + MEGAPGSIZE - 1) & ~(uint64)(MEGAPGSIZE - 1)) - top;
+  check(sbrk(pad) != (char*)-1, "sbrk pad");
+
+  check(memstat(&before, 0, 0) >= 0, "memstat");
+  char *base = sbrk(HEAPSIZE);
+  check(base != (char*)-1, "sbrk");
+  for (int i = 0; i < npages; i++)
+    base[i * PGSIZE] = i & 0xff;
+  check(memstat(&after, 0, 0) >= 0, "memstat");
+  printf("%d pages touched: %lu faults\n", npages, after.nfault - before.nfault);
+  check(after.nfault - before.nfault < npages / 64, "too many faults; no megapages?");
+
+  // Give back half a megapage plus a bit, keep the rest.
+  int keep = npages - MEGAPGSIZE / PGSIZE / 2 - 3;
+  sbrk(-(npages - keep) * PGSIZE);
+  for (int i = 0; i < keep; i++)
+    check(base[i * PGSIZE] == (char)(i & 0xff), "heap data lost after shrink");
+  sbrk(-keep * PGSIZE - pad);
+  check(memstat(&after, 0, 0) >= 0, "memstat");
+  check(after.anon <= before.anon, "heap pages not freed");
+}
+
+// fork() shares megapages copy-on-write; a write on either side
+// must split only that side's mapping.
+void test_mega_fork() {
+  printf("\n[3] fork with megapages\n");
+  int n = 2 * MEGAPGSIZE / sizeof(int);
+  int *m = (int*)mmap(0, 2 * MEGAPGSIZE, PROT_READ | PROT_WRITE,
+                      MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  check(m != 0, "mmap");
+  for (int i = 0; i < n; i += 1024)
+    m[i] = i;
+
+  int pid = fork();
+  check(pid >= 0, "fork");
+  if (pid == 0) {
+    m[1024] = -1;
+    for (int i = 0; i < n; i += 1024)
+      check(m[i] == (i == 1024 ? -1 : i), "child data wrong");
+    exit(0);
+  }
+  int status;
+  wait(&status);
+  check(status == 0, "child failed");
+  for (int i = 0; i < n; i += 1024)
+    check(m[i] == i, "parent sees child's write");
+  m[0] = 7;   // now the only user of the megapage
+  check(m[0] == 7, "parent write");
+  check(munmap((uint64)m) == 1, "munmap");
+}
+
+int main() {
+  printf("== Megapage Test Start ==\n");
+
+  test_mega_mmap();
+  test_mega_heap();
+  test_mega_fork();
+
+  printf("\n== All megapage tests passed ==\n");
+  exit(0);
+}
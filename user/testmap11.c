@@ -0,0 +1,72 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/memstat.h"
+#include "user.h"
+
+#define PGSIZE         4096
+#define PROT_READ      0x1
+#define PROT_WRITE     0x2
+#define MAP_ANONYMOUS  0x1
+#define MAP_POPULATE   0x2
+
+// An mmap offset whose 1GB of address space nothing else uses,
+// so its level-1 and level-0 page-table pages are its own.
+#define FARADDR        (1L << 30)
+
+void check(int cond, char *msg) {
+  if (!cond) {
+    printf("FAIL: %s\n", msg);
+    exit(1);
+  }
+}
+
+uint64 pgtbl() {
+  struct memstat ms;
+  check(memstat(&ms, 0, 0) >= 0, "memstat");
+  return ms.pgtbl;
+}
+
+// A lone page needs a level-1 and a level-0 page-table page,
+// and both go away with it.
+void test_lone_page() {
+  printf("\n[1] One page in an empty gigabyte\n");
+  uint64 before = pgtbl();
+
+  int *m = (int*)mmap(FARADDR, PGSIZE, PROT_READ | PROT_WRITE,
+                      MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  check(m != 0, "mmap");
+  *m = 1;
+  check(pgtbl() == before + 2, "expected two new page-table pages");
+  check(munmap((uint64)m) == 1, "munmap");
+  check(pgtbl() == before, "page-table pages not freed");
+}
+
+// Page-table pages stay while any page they map is left.
+void test_shared_table() {
+  printf("\n[2] Two mappings sharing a page-table page\n");
+  uint64 before = pgtbl();
+
+  int *a = (int*)mmap(FARADDR, PGSIZE, PROT_READ | PROT_WRITE,
+                      MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  int *b = (int*)mmap(FARADDR + 8 * PGSIZE, PGSIZE, PROT_READ | PROT_WRITE,
+                      MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  check(a != 0 && b != 0, "mmap");
+  *a = 1;
+  *b = 2;
+  check(pgtbl() == before + 2, "expected two new page-table pages");
+  check(munmap((uint64)a) == 1, "munmap a");
+  check(pgtbl() == before + 2, "page-table page freed while in use");
+  check(*b == 2, "data lost");
+  check(munmap((uint64)b) == 1, "munmap b");
+  check(pgtbl() == before, "page-table pages not freed");
+}
+
+int main() {
+  printf("== Page Table Test Start ==\n");
+
+  test_lone_page();
+  test_shared_table();
+
+  printf("\n== All page table tests passed ==\n");
+  exit(0);
+}
@@ -0,0 +1,108 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/memstat.h"
+#include "kernel/fcntl.h"
+#include "user.h"
+
+#define PGSIZE         4096
+#define BSSPAGES       256
+
+// Initialized data, and a bss array exec() must not allocate
+// up front.
+int table[4] = { 11, 22, 33, 44 };
+char big[BSSPAGES * PGSIZE];
+char rbuf[2 * PGSIZE];    // left untouched until test_read_self()
+
+void check(int cond, char *msg) {
+  if (!cond) {
+    printf("FAIL: %s\n", msg);
+    exit(1);
+  }
+}
+
+void check_image() {
+  check(table[0] == 11 && table[3] == 44, "initialized data wrong");
+  for (int i = 0; i < BSSPAGES; i++)
+    check(big[i * PGSIZE] == 0 && big[i * PGSIZE + PGSIZE - 1] == 0, "bss not zero");
+}
+
+// The bss is only allocated as it is touched.
+void test_lazy_bss() {
+  printf("\n[1] Lazy bss\n");
+  struct memstat before, after;
+
+  check(memstat(&before, 0, 0) >= 0, "memstat");
+  for (int i = 0; i < BSSPAGES; i++)
+    big[i * PGSIZE] = i;
+  check(memstat(&after, 0, 0) >= 0, "memstat");
+  printf("touching %d bss pages took %lu anonymous pages\n",
+         BSSPAGES, after.anon - before.anon);
+  check(after.anon - before.anon >= BSSPAGES / 2, "bss allocated by exec");
+  for (int i = 0; i < BSSPAGES; i++)
+    check(big[i * PGSIZE] == (char)i, "bss data lost");
+}
+
+// A child sees the parent's data, and its own changes stay private.
+void test_fork() {
+  printf("\n[2] Fork\n");
+  table[1] = 99;
+  int pid = fork();
+  check(pid >= 0, "fork");
+  if (pid == 0) {
+    check(table[1] == 99 && table[2] == 33, "child data wrong");
+    check(big[5 * PGSIZE] == 5, "child bss wrong");
+    table[2] = -1;
+    big[5 * PGSIZE] = -1;
+    exit(0);
+  }
+  int status;
+  wait(&status);
+  check(status == 0, "child failed");
+  check(table[2] == 33 && big[5 * PGSIZE] == 5, "child write reached parent");
+}
+
+// A fresh exec of this program starts from the file again.
+void test_exec() {
+  printf("\n[3] Exec\n");
+  int pid = fork();
+  check(pid >= 0, "fork");
+  if (pid == 0) {
+    char *argv[] = { "testmap12", "fresh", 0 };
+    exec("testmap12", argv);
+    check(0, "exec");
+  }
+  int status;
+  wait(&status);
+  check(status == 0, "exec'd image wrong");
+}
+
+// read() of the program's own file into an untouched bss page:
+// the page is read in while the file's inode is unlocked.
+void test_read_self() {
+  printf("\n[4] read() of the program into its bss\n");
+  int fd = open("testmap12", O_RDONLY);
+
+  check(fd >= 0, "open");
+  check(read(fd, rbuf + PGSIZE, PGSIZE) == PGSIZE, "read into bss failed");
+  check(rbuf[PGSIZE] == 0x7f && rbuf[PGSIZE + 1] == 'E', "wrong data");
+  check(rbuf[0] == 0, "bss not zero");
+  close(fd);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc == 2 && strcmp(argv[1], "fresh") == 0) {
+    check_image();
+    exit(0);
+  }
+
+  printf("== Demand-Paged Exec Test Start ==\n");
+
+  check(table[0] == 11 && table[3] == 44, "initialized data wrong");
+  test_lazy_bss();
+  test_fork();
+  test_exec();
+  test_read_self();
+
+  printf("\n== All exec tests passed ==\n");
+  exit(0);
+}
@@ -0,0 +1,73 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/memstat.h"
+#include "user.h"
+
+#define NCHILD 4
+
+void check(int cond, char *msg) {
+  if (!cond) {
+    printf("FAIL: %s\n", msg);
+    exit(1);
+  }
+}
+
+// Instances of one program share their text through the page
+// cache: each one after the first adds mappings, not copies.
+void test_shared_text() {
+  printf("\n[1] %d instances of one program\n", NCHILD);
+  struct memstat before, after;
+  int ready[2], hold[2];
+  char c;
+
+  check(pipe(ready) == 0 && pipe(hold) == 0, "pipe");
+  check(memstat(&before, 0, 0) >= 0, "memstat");
+  for (int i = 0; i < NCHILD; i++) {
+    int pid = fork();
+    check(pid >= 0, "fork");
+    if (pid == 0) {
+      // Run a fresh copy of this program, which reports in
+      // on ready[1] and then waits until the parent closes hold[1].
+      char rfd[2] = { '0' + ready[1], 0 }, hfd[2] = { '0' + hold[0], 0 };
+      close(ready[0]);
+      close(hold[1]);
+      char *argv[] = { "testmap13", rfd, hfd, 0 };
+      exec("testmap13", argv);
+      check(0, "exec");
+    }
+  }
+  close(ready[1]);
+  close(hold[0]);
+  for (int i = 0; i < NCHILD; i++)
+    check(read(ready[0], &c, 1) == 1, "child did not start");
+
+  check(memstat(&after, 0, 0) >= 0, "memstat");
+  printf("page cache: %lu pages, %lu copies saved\n", after.pcache, after.pcsaved);
+  check(after.pcache > 0, "nothing cached");
+  check(after.pcsaved >= before.pcsaved + NCHILD, "text not shared");
+
+  close(hold[1]);
+  for (int i = 0; i < NCHILD; i++)
+    wait(0);
+  close(ready[0]);
+
+  check(memstat(&after, 0, 0) >= 0, "memstat");
+  check(after.pcsaved <= before.pcsaved, "mappings left behind");
+}
+
+int main(int argc, char *argv[]) {
+  char c;
+
+  if (argc == 3) {
+    write(atoi(argv[1]), "x", 1);
+    read(atoi(argv[2]), &c, 1);
+    exit(0);
+  }
+
+  printf("== Page Cache Test Start ==\n");
+
+  test_shared_text();
+
+  printf("\n== All page cache tests passed ==\n");
+  exit(0);
+}
@@ -0,0 +1,85 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user.h"
+
+#define PGSIZE         4096
+#define PROT_READ      0x1
+#define PROT_WRITE     0x2
+#define MAP_ANONYMOUS  0x1
+#define MAP_POPULATE   0x2
+#define MMAPBASE       0x40000000UL
+
+#define NAREA          256
+
+char *areas[NAREA];
+
+void check(int cond, char *msg) {
+  if (!cond) {
+    printf("FAIL: %s\n", msg);
+    exit(1);
+  }
+}
+
+// Far more mappings than the old system-wide table held, each
+// placed by the kernel right after the previous one.
+void test_many_areas() {
+  printf("\n[1] %d mappings in one process\n", NAREA);
+  for (int i = 0; i < NAREA; i++) {
+    areas[i] = (char*)mmap(0, PGSIZE, PROT_READ | PROT_WRITE, MAP_ANONYMOUS, -1, 0);
+    check(areas[i] != 0, "mmap");
+    check((uint64)areas[i] == MMAPBASE + (uint64)i * PGSIZE, "not placed first-fit");
+    areas[i][0] = i;
+  }
+  for (int i = 0; i < NAREA; i++)
+    check(areas[i][0] == (char)i, "data lost");
+}
+
+// A freed gap is the first one a new mapping of its size gets;
+// a larger mapping goes past it.
+void test_first_fit() {
+  printf("\n[2] First fit\n");
+  check(munmap((uint64)areas[10]) == 1 && munmap((uint64)areas[11]) == 1, "munmap");
+  char *big = (char*)mmap(0, 3 * PGSIZE, PROT_READ | PROT_WRITE, MAP_ANONYMOUS, -1, 0);
+  check(big == areas[NAREA - 1] + PGSIZE, "3-page mapping should go after the last one");
+  char *two = (char*)mmap(0, 2 * PGSIZE, PROT_READ | PROT_WRITE, MAP_ANONYMOUS, -1, 0);
+  check(two == areas[10], "2-page mapping should fill the gap");
+  two[PGSIZE] = 1;
+  check(munmap((uint64)two) == 1 && munmap((uint64)big) == 1, "munmap");
+}
+
+// The child gets its own copy of every area.
+void test_fork() {
+  printf("\n[3] Fork\n");
+  int pid = fork();
+  check(pid >= 0, "fork");
+  if (pid == 0) {
+    for (int i = 0; i < NAREA; i++) {
+      if (i == 10 || i == 11)
+        continue;
+      check(areas[i][0] == (char)i, "child data wrong");
+      areas[i][0] = -1;
+      check(munmap((uint64)areas[i]) == 1, "child munmap");
+    }
+    exit(0);
+  }
+  int status;
+  wait(&status);
+  check(status == 0, "child failed");
+  for (int i = 0; i < NAREA; i++) {
+    if (i == 10 || i == 11)
+      continue;
+    check(areas[i][0] == (char)i, "child write reached parent");
+    check(munmap((uint64)areas[i]) == 1, "munmap");
+  }
+}
+
+int main() {
+  printf("== mmap Tree Test Start ==\n");
+
+  test_many_areas();
+  test_first_fit();
+  test_fork();
+
+  printf("\n== All mmap tree tests passed ==\n");
+  exit(0);
+}
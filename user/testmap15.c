@@ -0,0 +1,156 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user.h"
+
+#define PGSIZE      4096
+#define PROT_READ   0x1
+#define PROT_WRITE  0x2
+#define MAP_SHARED  0x4
+
+#define FILE   "mapshared"
+#define NPAGES 3
+
+void check(int cond, char *msg) {
+  if (!cond) {
+    printf("FAIL: %s\n", msg);
+    exit(1);
+  }
+}
+
+// Create FILE with NPAGES pages of 'a'.
+void make_file() {
+  char buf[PGSIZE];
+  int fd;
+
+  unlink(FILE);
+  fd = open(FILE, O_CREATE | O_RDWR);
+  check(fd >= 0, "create");
+  memset(buf, 'a', PGSIZE);
+  for (int i = 0; i < NPAGES; i++)
+    check(write(fd, buf, PGSIZE) == PGSIZE, "write");
+  close(fd);
+}
+
+// Read the byte at off in FILE with read().
+char file_byte(int off) {
+  char c = 0;
+  int fd = open(FILE, O_RDONLY);
+
+  check(fd >= 0, "open");
+  for (int i = 0; i <= off; i++)
+    check(read(fd, &c, 1) == 1, "read");
+  close(fd);
+  return c;
+}
+
+// Write c at off in FILE with write(); off is at most PGSIZE.
+void file_write(int off, char c) {
+  char buf[PGSIZE];
+  int fd = open(FILE, O_RDWR);
+
+  check(fd >= 0, "open");
+  check(read(fd, buf, off) == off, "read");
+  check(write(fd, &c, 1) == 1, "write");
+  close(fd);
+}
+
+char *map_file(int *fdp) {
+  int fd = open(FILE, O_RDWR);
+  char *p;
+
+  check(fd >= 0, "open");
+  p = (char*)mmap(0, NPAGES * PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  check(p != 0, "mmap shared");
+  *fdp = fd;
+  return p;
+}
+
+// Stores reach the file on msync(), and on munmap().
+void test_writeback() {
+  printf("\n[1] msync and munmap write back\n");
+  int fd;
+  char *p;
+
+  make_file();
+  p = map_file(&fd);
+  p[0] = 'b';
+  p[PGSIZE + 1] = 'c';
+  check(msync((uint64)p, NPAGES * PGSIZE) == 0, "msync");
+  check(file_byte(0) == 'b' && file_byte(PGSIZE + 1) == 'c', "msync did not write");
+
+  p[2 * PGSIZE] = 'd';
+  check(munmap((uint64)p) == 1, "munmap");
+  check(file_byte(2 * PGSIZE) == 'd', "munmap did not write");
+  close(fd);
+}
+
+// Parent and child map the same pages: each sees the
+// other's stores, with no copy-on-write between them.
+void test_fork() {
+  printf("\n[2] shared across fork\n");
+  int fd, pid, st;
+  char *p;
+
+  make_file();
+  p = map_file(&fd);
+  p[10] = 'p';
+  pid = fork();
+  check(pid >= 0, "fork");
+  if (pid == 0) {
+    if (p[10] != 'p')
+      exit(1);
+    p[20] = 'c';
+    exit(0);  // exit writes back
+  }
+  wait(&st);
+  check(st == 0, "child did not see the parent's store");
+  check(p[20] == 'c', "parent did not see the child's store");
+  check(file_byte(20) == 'c', "child's store not in the file");
+  munmap((uint64)p);
+  close(fd);
+}
+
+// Two mappings of one file, in unrelated processes, and
+// write() all see the same data.
+void test_coherent() {
+  printf("\n[3] mappings and write() agree\n");
+  int fd, pid, st, sync[2];
+  char *p, c;
+
+  make_file();
+  p = map_file(&fd);
+  check(pipe(sync) == 0, "pipe");
+  pid = fork();
+  check(pid >= 0, "fork");
+  if (pid == 0) {
+    int cfd;
+    close(sync[1]);
+    munmap((uint64)p);   // map it afresh, not inherited
+    p = map_file(&cfd);
+    read(sync[0], &c, 1);
+    exit(p[PGSIZE] == 'w' && p[PGSIZE + 5] == 'm' ? 0 : 1);
+  }
+  close(sync[0]);
+  file_write(PGSIZE, 'w');
+  check(p[PGSIZE] == 'w', "write() not seen by mapping");
+  p[PGSIZE + 5] = 'm';
+  write(sync[1], "x", 1);
+  wait(&st);
+  check(st == 0, "other mapping did not see the stores");
+  munmap((uint64)p);
+  close(fd);
+  close(sync[1]);
+}
+
+int main(int argc, char *argv[]) {
+  printf("== Shared Mapping Test Start ==\n");
+
+  test_writeback();
+  test_fork();
+  test_coherent();
+
+  unlink(FILE);
+  printf("\n== All shared mapping tests passed ==\n");
+  exit(0);
+}
@@ -0,0 +1,94 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/memstat.h"
+#include "user.h"
+
+#define PGSIZE         4096
+#define PROT_READ      0x1
+#define PROT_WRITE     0x2
+#define MAP_ANONYMOUS  0x1
+#define MAP_SHARED     0x4
+
+#define FILE   "faultaround"
+#define NPAGES 32
+
+void check(int cond, char *msg) {
+  if (!cond) {
+    printf("FAIL: %s\n", msg);
+    exit(1);
+  }
+}
+
+uint64 faults() {
+  struct memstat ms;
+  check(memstat(&ms, 0, 0) >= 0, "memstat");
+  return ms.nfault;
+}
+
+// Create FILE: byte i of page n is n + i.
+void make_file() {
+  char buf[PGSIZE];
+  int fd;
+
+  unlink(FILE);
+  fd = open(FILE, O_CREATE | O_RDWR);
+  check(fd >= 0, "create");
+  for (int n = 0; n < NPAGES; n++) {
+    for (int i = 0; i < PGSIZE; i++)
+      buf[i] = n + i;
+    check(write(fd, buf, PGSIZE) == PGSIZE, "write");
+  }
+  close(fd);
+}
+
+// Read every page of p in order and check it. Returns the
+// page faults taken.
+uint64 scan(char *p, int anon) {
+  uint64 before = faults();
+
+  for (int n = 0; n < NPAGES; n++)
+    for (int i = 0; i < PGSIZE; i += 512)
+      check(p[n * PGSIZE + i] == (anon ? 0 : (char)(n + i)), "wrong data");
+  return faults() - before;
+}
+
+// A sequential read of a mapping faults once per window of
+// pages, not once per page.
+void test_scan(char *name, int flags) {
+  int anon = flags & MAP_ANONYMOUS;
+  int fd = -1;
+  uint64 n;
+  char *p;
+
+  printf("\n%s\n", name);
+  if (!anon) {
+    fd = open(FILE, O_RDWR);
+    check(fd >= 0, "open");
+  }
+  p = (char*)mmap(0, NPAGES * PGSIZE, PROT_READ | PROT_WRITE, flags, fd, 0);
+  check(p != 0, "mmap");
+  n = scan(p, anon);
+  printf("%d pages read with %lu faults\n", NPAGES, n);
+  check(n <= NPAGES / 8, "too many faults");
+
+  // Writes to pages mapped by a read fault go through.
+  p[5 * PGSIZE] = 'x';
+  check(p[5 * PGSIZE] == 'x', "write lost");
+  check(munmap((uint64)p) == 1, "munmap");
+  if (fd >= 0)
+    close(fd);
+}
+
+int main(int argc, char *argv[]) {
+  printf("== Fault-Around Test Start ==\n");
+
+  make_file();
+  test_scan("[1] Private file mapping", 0);
+  test_scan("[2] Shared file mapping", MAP_SHARED);
+  test_scan("[3] Anonymous mapping", MAP_ANONYMOUS);
+
+  unlink(FILE);
+  printf("\n== All fault-around tests passed ==\n");
+  exit(0);
+}
@@ -0,0 +1,134 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/memstat.h"
+#include "user.h"
+
+#define PGSIZE      4096
+#define PROT_READ   0x1
+#define PROT_WRITE  0x2
+
+#define FILE   "unified"
+#define NPAGES 16
+
+void check(int cond, char *msg) {
+  if (!cond) {
+    printf("FAIL: %s\n", msg);
+    exit(1);
+  }
+}
+
+void stat_now(struct memstat *ms) {
+  check(memstat(ms, 0, 0) >= 0, "memstat");
+}
+
+// Create FILE: page n is all 'a' + n.
+void make_file() {
+  char buf[PGSIZE];
+  int fd;
+
+  unlink(FILE);
+  fd = open(FILE, O_CREATE | O_RDWR);
+  check(fd >= 0, "create");
+  for (int n = 0; n < NPAGES; n++) {
+    memset(buf, 'a' + n, PGSIZE);
+    check(write(fd, buf, PGSIZE) == PGSIZE, "write");
+  }
+  close(fd);
+}
+
+// Read page n of FILE with read() and check it holds c.
+void check_page(int n, char c) {
+  char buf[PGSIZE];
+  int fd = open(FILE, O_RDONLY);
+
+  check(fd >= 0, "open");
+  for (int i = 0; i <= n; i++)
+    check(read(fd, buf, PGSIZE) == PGSIZE, "read");
+  for (int i = 0; i < PGSIZE; i++)
+    check(buf[i] == c, "wrong data from read()");
+  close(fd);
+}
+
+// A file read with read() and then mapped is in memory once:
+// the mapping uses the pages read() left in the page cache.
+void test_read_then_map() {
+  printf("\n[1] read() and mmap share pages\n");
+  struct memstat before, after;
+  int fd;
+  char *p;
+
+  for (int n = 0; n < NPAGES; n++)
+    check_page(n, 'a' + n);
+
+  stat_now(&before);
+  fd = open(FILE, O_RDONLY);
+  check(fd >= 0, "open");
+  p = (char*)mmap(0, NPAGES * PGSIZE, PROT_READ, 0, fd, 0);
+  check(p != 0, "mmap");
+  for (int n = 0; n < NPAGES; n++)
+    check(p[n * PGSIZE + 7] == 'a' + n, "wrong data in mapping");
+  stat_now(&after);
+
+  printf("file pages %lu -> %lu, cache hits %lu -> %lu\n",
+         before.file, after.file, before.pchit, after.pchit);
+  check(after.pchit >= before.pchit + NPAGES, "mapping did not use the cache");
+  check(after.file < before.file + NPAGES / 4, "mapping copied the pages");
+  check(munmap((uint64)p) == 1, "munmap");
+  close(fd);
+}
+
+// A private mapping shares the cache's pages only until it
+// writes; the file and read() never see its stores.
+void test_private_write() {
+  printf("\n[2] private mapping copies on write\n");
+  int fd;
+  char *p;
+
+  fd = open(FILE, O_RDWR);
+  check(fd >= 0, "open");
+  p = (char*)mmap(0, NPAGES * PGSIZE, PROT_READ | PROT_WRITE, 0, fd, 0);
+  check(p != 0, "mmap");
+  check(p[PGSIZE] == 'b', "wrong data in mapping");
+  p[PGSIZE] = 'z';
+  check(p[PGSIZE] == 'z', "store lost");
+  check_page(1, 'b');
+  check(munmap((uint64)p) == 1, "munmap");
+  check_page(1, 'b');
+  close(fd);
+}
+
+// write() reaches pages already cached, so read() and new
+// mappings see it.
+void test_write_through() {
+  printf("\n[3] write() updates cached pages\n");
+  char buf[PGSIZE];
+  int fd;
+  char *p;
+
+  fd = open(FILE, O_RDWR);
+  check(fd >= 0, "open");
+  p = (char*)mmap(0, NPAGES * PGSIZE, PROT_READ, 0, fd, 0);
+  check(p != 0, "mmap");
+  check(p[0] == 'a', "wrong data in mapping");
+
+  memset(buf, 'q', PGSIZE);
+  check(write(fd, buf, PGSIZE) == PGSIZE, "write");
+  check_page(0, 'q');
+  check(p[0] == 'q', "mapping did not see write()");
+  check(munmap((uint64)p) == 1, "munmap");
+  close(fd);
+}
+
+int main(int argc, char *argv[]) {
+  printf("== Unified Page Cache Test Start ==\n");
+
+  make_file();
+  test_read_then_map();
+  test_private_write();
+  test_write_through();
+
+  unlink(FILE);
+  printf("\n== All unified page cache tests passed ==\n");
+  exit(0);
+}
@@ -0,0 +1,93 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/memstat.h"
+#include "user.h"
+
+#define PGSIZE         4096
+#define PROT_READ      0x1
+#define PROT_WRITE     0x2
+#define MAP_ANONYMOUS  0x1
+
+#define NPAGES         1024    // 4MB, room for megapages
+
+void check(int cond, char *msg) {
+  if (!cond) {
+    printf("FAIL: %s\n", msg);
+    exit(1);
+  }
+}
+
+void stat_now(struct memstat *ms) {
+  check(memstat(ms, 0, 0) >= 0, "memstat");
+}
+
+// Reading an untouched anonymous area maps the zero page
+// everywhere and allocates no memory.
+void test_sparse_read() {
+  printf("\n[1] Reading %d untouched pages\n", NPAGES);
+  struct memstat before, after;
+  char *m;
+  int sum = 0;
+
+  stat_now(&before);
+  m = (char*)mmap(0, NPAGES * PGSIZE, PROT_READ | PROT_WRITE, MAP_ANONYMOUS, -1, 0);
+  check(m != 0, "mmap");
+  for (int i = 0; i < NPAGES; i++)
+    sum += m[i * PGSIZE + i % PGSIZE];
+  check(sum == 0, "untouched memory not zero");
+  stat_now(&after);
+
+  printf("anon pages %lu -> %lu, zero-page mappings %lu -> %lu\n",
+         before.anon, after.anon, before.zeromap, after.zeromap);
+  check(after.anon < before.anon + 8, "reads allocated memory");
+  check(after.zeromap >= before.zeromap + NPAGES, "zero page not mapped");
+
+  // [2] The first write to a page gives it a page of its own,
+  // and leaves the others on the zero page.
+  printf("\n[2] Writing one of them\n");
+  m[5 * PGSIZE + 1] = 'w';
+  check(m[5 * PGSIZE + 1] == 'w' && m[5 * PGSIZE] == 0, "write lost");
+  check(m[6 * PGSIZE + 1] == 0 && m[4 * PGSIZE + 1] == 0, "write leaked");
+  stat_now(&before);
+  check(before.anon == after.anon + 1, "expected one new page");
+  check(before.zeromap == after.zeromap - 1, "written page still on the zero page");
+
+  check(munmap((uint64)m) == 1, "munmap");
+  stat_now(&after);
+  check(after.zeromap + NPAGES <= before.zeromap + 1, "zero-page mappings left behind");
+}
+
+// A child shares the zero page, and its writes stay its own.
+void test_fork() {
+  printf("\n[3] Zero page across fork\n");
+  char *m;
+  int pid, st;
+
+  m = (char*)mmap(0, 16 * PGSIZE, PROT_READ | PROT_WRITE, MAP_ANONYMOUS, -1, 0);
+  check(m != 0, "mmap");
+  check(m[3 * PGSIZE] == 0, "not zero");
+  pid = fork();
+  check(pid >= 0, "fork");
+  if (pid == 0) {
+    if (m[3 * PGSIZE] != 0)
+      exit(1);
+    m[3 * PGSIZE] = 'c';
+    exit(m[3 * PGSIZE] == 'c' ? 0 : 1);
+  }
+  wait(&st);
+  check(st == 0, "child");
+  check(m[3 * PGSIZE] == 0, "child's write reached the parent");
+  m[3 * PGSIZE] = 'p';
+  check(m[3 * PGSIZE] == 'p', "parent's write lost");
+  check(munmap((uint64)m) == 1, "munmap");
+}
+
+int main(int argc, char *argv[]) {
+  printf("== Zero Page Test Start ==\n");
+
+  test_sparse_read();
+  test_fork();
+
+  printf("\n== All zero page tests passed ==\n");
+  exit(0);
+}
@@ -0,0 +1,198 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/memstat.h"
+#include "user.h"
+
+#define PGSIZE          4096
+#define PROT_READ       0x1
+#define PROT_WRITE      0x2
+#define MAP_ANONYMOUS   0x1
+#define MAP_SHARED      0x4
+#define MADV_NORMAL     0
+#define MADV_RANDOM     1
+#define MADV_SEQUENTIAL 2
+#define MADV_WILLNEED   3
+#define MADV_DONTNEED   4
+
+#define FILE   "advise"
+#define NPAGES 32
+
+void check(int cond, char *msg) {
+  if (!cond) {
+    printf("FAIL: %s\n", msg);
+    exit(1);
+  }
+}
+
+void stat_now(struct memstat *ms) {
+  check(memstat(ms, 0, 0) >= 0, "memstat");
+}
+
+// Create FILE: page n is all 'a' + n.
+void make_file() {
+  char buf[PGSIZE];
+  int fd;
+
+  unlink(FILE);
+  fd = open(FILE, O_CREATE | O_RDWR);
+  check(fd >= 0, "create");
+  for (int n = 0; n < NPAGES; n++) {
+    memset(buf, 'a' + n, PGSIZE);
+    check(write(fd, buf, PGSIZE) == PGSIZE, "write");
+  }
+  close(fd);
+}
+
+// Run a child that stores to p. Returns 1 if the store went
+// through, 0 if the child was killed for it.
+int store_ok(char *p) {
+  int pid, st;
+
+  pid = fork();
+  check(pid >= 0, "fork");
+  if (pid == 0) {
+    *p = 'x';
+    exit(0);
+  }
+  wait(&st);
+  return st == 0;
+}
+
+// mprotect() on the middle page of a mapping makes just that
+// page read-only, and back.
+void test_mprotect() {
+  printf("\n[1] mprotect on part of a mapping\n");
+  char *m;
+
+  m = (char*)mmap(0, 3 * PGSIZE, PROT_READ | PROT_WRITE, MAP_ANONYMOUS, -1, 0);
+  check(m != 0, "mmap");
+  m[0] = m[PGSIZE] = m[2 * PGSIZE] = 'm';
+  check(mprotect((uint64)m + PGSIZE, PGSIZE, PROT_READ) == 0, "mprotect read-only");
+  check(m[PGSIZE] == 'm', "data lost");
+  check(!store_ok(m + PGSIZE), "store to a read-only page went through");
+  check(store_ok(m) && store_ok(m + 2 * PGSIZE), "neighbours became read-only");
+
+  check(mprotect((uint64)m + PGSIZE, PGSIZE, PROT_READ | PROT_WRITE) == 0, "mprotect writable");
+  m[PGSIZE] = 'w';
+  check(m[PGSIZE] == 'w', "store lost");
+
+  // the pieces are one mapping again
+  check(mprotect((uint64)m, 3 * PGSIZE, PROT_READ) == 0, "mprotect whole");
+  check(mprotect((uint64)m, 3 * PGSIZE, PROT_READ | PROT_WRITE) == 0, "mprotect whole");
+  check(m[2 * PGSIZE] == 'm', "data lost");
+  check(mprotect((uint64)m, PGSIZE, 0) < 0, "bad prot accepted");
+  check(munmap((uint64)m) == 1, "munmap");
+  check(!store_ok(m + 2 * PGSIZE), "pieces left mapped");
+}
+
+// A read-only file can't be made writable.
+void test_mprotect_file() {
+  printf("\n[2] mprotect on a read-only file\n");
+  int fd = open(FILE, O_RDONLY);
+  char *m;
+
+  check(fd >= 0, "open");
+  m = (char*)mmap(0, PGSIZE, PROT_READ, 0, fd, 0);
+  check(m != 0, "mmap");
+  check(mprotect((uint64)m, PGSIZE, PROT_READ | PROT_WRITE) < 0, "made a read-only file writable");
+  check(m[0] == 'a', "wrong data");
+  munmap((uint64)m);
+  close(fd);
+}
+
+// MADV_DONTNEED frees anonymous pages, which read as zero
+// again, and writes a shared file mapping back first.
+void test_dontneed() {
+  printf("\n[3] MADV_DONTNEED\n");
+  struct memstat before, after;
+  char *m;
+  int fd;
+
+  m = (char*)mmap(0, 8 * PGSIZE, PROT_READ | PROT_WRITE, MAP_ANONYMOUS, -1, 0);
+  check(m != 0, "mmap");
+  for (int i = 0; i < 8; i++)
+    m[i * PGSIZE] = 'd';
+  stat_now(&before);
+  check(madvise((uint64)m, 8 * PGSIZE, MADV_DONTNEED) == 0, "madvise");
+  stat_now(&after);
+  check(after.anon + 8 <= before.anon, "pages not freed");
+  for (int i = 0; i < 8; i++)
+    check(m[i * PGSIZE] == 0, "dropped page not zero");
+  munmap((uint64)m);
+
+  fd = open(FILE, O_RDWR);
+  check(fd >= 0, "open");
+  m = (char*)mmap(0, NPAGES * PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  check(m != 0, "mmap");
+  m[3 * PGSIZE] = 'S';
+  check(madvise((uint64)m + 3 * PGSIZE, PGSIZE, MADV_DONTNEED) == 0, "madvise");
+  check(m[3 * PGSIZE] == 'S', "shared store lost");
+  munmap((uint64)m);
+  close(fd);
+}
+
+// Sequential scans of a file mapping, after each kind of
+// advice. Returns the page faults taken.
+uint64 scan(int advice) {
+  struct memstat before, after;
+  int fd = open(FILE, O_RDONLY);
+  char *m;
+
+  check(fd >= 0, "open");
+  m = (char*)mmap(0, NPAGES * PGSIZE, PROT_READ, 0, fd, 0);
+  check(m != 0, "mmap");
+  check(madvise((uint64)m, NPAGES * PGSIZE, advice) == 0, "madvise");
+  stat_now(&before);
+  for (int n = 0; n < NPAGES; n++)
+    check(m[n * PGSIZE + 100] == 'a' + n, "wrong data");
+  stat_now(&after);
+  munmap((uint64)m);
+  close(fd);
+  return after.nfault - before.nfault;
+}
+
+void test_fault_advice() {
+  printf("\n[4] MADV_RANDOM and MADV_SEQUENTIAL\n");
+  uint64 r = scan(MADV_RANDOM), n = scan(MADV_NORMAL), s = scan(MADV_SEQUENTIAL);
+
+  printf("%d pages: %lu faults random, %lu normal, %lu sequential\n", NPAGES, r, n, s);
+  check(r >= NPAGES, "random advice still faults around");
+  check(n < r && s <= n, "sequential advice faults more");
+}
+
+// MADV_WILLNEED reads the file in before it is touched.
+void test_willneed() {
+  printf("\n[5] MADV_WILLNEED\n");
+  struct memstat before, after;
+  int fd = open(FILE, O_RDONLY);
+  char *m;
+
+  check(fd >= 0, "open");
+  m = (char*)mmap(0, NPAGES * PGSIZE, PROT_READ, 0, fd, 0);
+  check(m != 0, "mmap");
+  check(madvise((uint64)m, NPAGES * PGSIZE, MADV_WILLNEED) == 0, "madvise");
+  stat_now(&before);
+  for (int n = 0; n < NPAGES; n++)
+    check(m[n * PGSIZE] == (n == 3 ? 'S' : 'a' + n), "wrong data");
+  stat_now(&after);
+  check(after.pcmiss - before.pcmiss < NPAGES / 4, "pages read after WILLNEED");
+  check(madvise((uint64)m, NPAGES * PGSIZE, 9) < 0, "bad advice accepted");
+  munmap((uint64)m);
+  close(fd);
+}
+
+int main(int argc, char *argv[]) {
+  printf("== madvise/mprotect Test Start ==\n");
+
+  make_file();
+  test_mprotect();
+  test_mprotect_file();
+  test_dontneed();
+  test_fault_advice();
+  test_willneed();
+
+  unlink(FILE);
+  printf("\n== All madvise/mprotect tests passed ==\n");
+  exit(0);
+}
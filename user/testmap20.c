@@ -0,0 +1,116 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user.h"
+
+#define PGSIZE         4096
+#define PROT_READ      0x1
+#define PROT_WRITE     0x2
+#define MAP_ANONYMOUS  0x1
+
+void check(int cond, char *msg) {
+  if (!cond) {
+    printf("FAIL: %s\n", msg);
+    exit(1);
+  }
+}
+
+// Run a child that stores to p. Returns 1 if the store went
+// through, 0 if the child was killed for it.
+int store_ok(char *p) {
+  int pid, st;
+
+  pid = fork();
+  check(pid >= 0, "fork");
+  if (pid == 0) {
+    *p = 'x';
+    exit(0);
+  }
+  wait(&st);
+  return st == 0;
+}
+
+// Map n anonymous pages; page i holds 'a' + i.
+char *map_pages(int n) {
+  char *m = (char*)mmap(0, n * PGSIZE, PROT_READ | PROT_WRITE, MAP_ANONYMOUS, -1, 0);
+
+  check(m != 0, "mmap");
+  for (int i = 0; i < n; i++)
+    m[i * PGSIZE] = 'a' + i;
+  return m;
+}
+
+// munmaprange() takes out the middle, tail or head of a
+// mapping and leaves the rest of it.
+void test_munmap_part() {
+  printf("\n[1] munmap of part of a mapping\n");
+  char *m = map_pages(8);
+
+  check(munmaprange((uint64)m + 3 * PGSIZE, 2 * PGSIZE) == 1, "munmap middle");
+  check(!store_ok(m + 3 * PGSIZE) && !store_ok(m + 4 * PGSIZE), "middle still mapped");
+  check(m[2 * PGSIZE] == 'c' && m[5 * PGSIZE] == 'f', "neighbours lost data");
+
+  check(munmaprange((uint64)m + 7 * PGSIZE, PGSIZE) == 1, "munmap tail");
+  check(!store_ok(m + 7 * PGSIZE), "tail still mapped");
+  check(munmaprange((uint64)m, PGSIZE) == 1, "munmap head");
+  check(!store_ok(m), "head still mapped");
+  check(m[PGSIZE] == 'b' && m[6 * PGSIZE] == 'g', "rest lost data");
+  check(munmaprange((uint64)m + 1, PGSIZE) < 0, "unaligned address accepted");
+
+  // one call takes out what is left, across both pieces
+  check(munmaprange((uint64)m, 8 * PGSIZE) == 1, "munmap rest");
+  check(!store_ok(m + PGSIZE) && !store_ok(m + 6 * PGSIZE), "pieces left mapped");
+}
+
+// A range may span several mappings.
+void test_munmap_span() {
+  printf("\n[2] munmap across two mappings\n");
+  char *a = map_pages(4);
+  char *b = map_pages(4);
+
+  check(b == a + 4 * PGSIZE, "mappings not adjacent");
+  check(munmaprange((uint64)a + 2 * PGSIZE, 4 * PGSIZE) == 1, "munmap span");
+  check(!store_ok(a + 3 * PGSIZE) && !store_ok(b + PGSIZE), "span still mapped");
+  check(a[PGSIZE] == 'b' && b[2 * PGSIZE] == 'c', "ends lost data");
+  check(munmap((uint64)a) == 1 && munmap((uint64)b + 2 * PGSIZE) == 1, "munmap ends");
+}
+
+// mremap() grows a mapping in place when the pages after it are
+// free, moves it when they aren't, and shrinks it.
+void test_mremap() {
+  printf("\n[3] mremap\n");
+  char *a, *b, *m;
+
+  a = map_pages(4);
+  m = (char*)mremap((uint64)a, 4 * PGSIZE, 6 * PGSIZE);
+  check(m == a, "did not grow in place");
+  check(m[3 * PGSIZE] == 'd' && m[5 * PGSIZE] == 0, "wrong data after growing");
+  m[5 * PGSIZE] = 'f';
+
+  b = map_pages(2);
+  check(b == a + 6 * PGSIZE, "mappings not adjacent");
+  m = (char*)mremap((uint64)a, 6 * PGSIZE, 8 * PGSIZE);
+  check(m != 0 && m != a, "did not move");
+  for (int i = 0; i < 4; i++)
+    check(m[i * PGSIZE] == 'a' + i, "data lost in the move");
+  check(m[5 * PGSIZE] == 'f' && m[7 * PGSIZE] == 0, "wrong data after moving");
+  check(!store_ok(a), "old address still mapped");
+  check(b[PGSIZE] == 'b', "blocking mapping changed");
+
+  check(mremap((uint64)m, 8 * PGSIZE, 2 * PGSIZE) == (uint64)m, "shrink");
+  check(m[PGSIZE] == 'b', "data lost in shrink");
+  check(!store_ok(m + 2 * PGSIZE), "shrunk pages still mapped");
+  check(mremap((uint64)m + 4 * PGSIZE, PGSIZE, 2 * PGSIZE) == 0, "unmapped range accepted");
+
+  check(munmap((uint64)m) == 1 && munmap((uint64)b) == 1, "munmap");
+}
+
+int main(int argc, char *argv[]) {
+  printf("== munmap/mremap Test Start ==\n");
+
+  test_munmap_part();
+  test_munmap_span();
+  test_mremap();
+
+  printf("\n== All munmap/mremap tests passed ==\n");
+  exit(0);
+}
@@ -0,0 +1,139 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/memstat.h"
+#include "user.h"
+
+#define PGSIZE         4096
+#define PROT_READ      0x1
+#define PROT_WRITE     0x2
+#define MAP_ANONYMOUS  0x1
+#define MAP_SHARED     0x4
+#define MADV_DONTNEED  4
+
+#define NPAGES  16
+#define NROUND  50
+
+void check(int cond, char *msg) {
+  if (!cond) {
+    printf("FAIL: %s\n", msg);
+    exit(1);
+  }
+}
+
+void stat_now(struct memstat *ms) {
+  check(memstat(ms, 0, 0) >= 0, "memstat");
+}
+
+char *map_shared(int n) {
+  char *m = (char*)mmap(0, n * PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+  check(m != 0, "mmap");
+  return m;
+}
+
+// Stores made on either side of fork() are seen by the other,
+// including to pages nobody had touched before the fork.
+void test_fork() {
+  printf("\n[1] Shared anonymous memory across fork\n");
+  char *m = map_shared(NPAGES);
+  int pid, st;
+
+  m[0] = 'p';
+  pid = fork();
+  check(pid >= 0, "fork");
+  if (pid == 0) {
+    if (m[0] != 'p')
+      exit(1);
+    for (int i = 0; i < NPAGES; i++)
+      m[i * PGSIZE + 1] = 'c';
+    exit(0);
+  }
+  wait(&st);
+  check(st == 0, "child did not see the parent's store");
+  for (int i = 0; i < NPAGES; i++)
+    check(m[i * PGSIZE + 1] == 'c', "child's store not seen");
+  check(madvise((uint64)m, PGSIZE, MADV_DONTNEED) < 0, "DONTNEED accepted");
+
+  // growing would give the new pages to this process only
+  check(mremap((uint64)m, NPAGES * PGSIZE, (NPAGES + 1) * PGSIZE) == 0, "mremap grew it");
+  check(mremap((uint64)m, NPAGES * PGSIZE, NPAGES / 2 * PGSIZE) == (uint64)m, "mremap shrink");
+  check(m[(NPAGES / 2 - 1) * PGSIZE + 1] == 'c', "data lost in shrink");
+  check(munmap((uint64)m) == 1, "munmap");
+}
+
+// A producer hands NROUND blocks to a consumer through the
+// shared pages; the pipes only say whose turn it is.
+void test_producer_consumer() {
+  printf("\n[2] Producer/consumer\n");
+  char *m = map_shared(NPAGES);
+  int full[2], empty[2], pid, st;
+  char c;
+
+  check(pipe(full) == 0 && pipe(empty) == 0, "pipe");
+  pid = fork();
+  check(pid >= 0, "fork");
+  if (pid == 0) {
+    // consumer: check each block, and write back its sum
+    for (int r = 0; r < NROUND; r++) {
+      int sum = 0;
+      if (read(full[0], &c, 1) != 1)
+        exit(1);
+      for (int i = 0; i < NPAGES * PGSIZE; i += 64)
+        sum += m[i] == (char)(r + i / PGSIZE);
+      *(int*)m = sum;
+      write(empty[1], &c, 1);
+    }
+    exit(0);
+  }
+  for (int r = 0; r < NROUND; r++) {
+    for (int i = 0; i < NPAGES * PGSIZE; i += 64)
+      m[i] = r + i / PGSIZE;
+    write(full[1], &c, 1);
+    check(read(empty[0], &c, 1) == 1, "consumer died");
+    check(*(int*)m == NPAGES * PGSIZE / 64, "consumer saw a wrong block");
+  }
+  wait(&st);
+  check(st == 0, "consumer");
+  printf("%d blocks of %d KB passed\n", NROUND, NPAGES * PGSIZE / 1024);
+  close(full[0]); close(full[1]); close(empty[0]); close(empty[1]);
+  check(munmap((uint64)m) == 1, "munmap");
+}
+
+// The pages outlive the child that unmapped them, and are freed
+// when the last process unmaps them.
+void test_free() {
+  printf("\n[3] Freed at the last unmap\n");
+  struct memstat before, after;
+  char *m;
+  int pid, st;
+
+  stat_now(&before);
+  m = map_shared(NPAGES);
+  m[0] = 'k';
+  pid = fork();
+  check(pid >= 0, "fork");
+  if (pid == 0) {
+    m[PGSIZE] = 'k';
+    exit(munmap((uint64)m) == 1 ? 0 : 1);
+  }
+  wait(&st);
+  check(st == 0, "child");
+  check(m[0] == 'k' && m[PGSIZE] == 'k', "data lost with the child");
+  stat_now(&after);
+  check(after.anon >= before.anon + NPAGES, "pages not allocated");
+  check(munmap((uint64)m) == 1, "munmap");
+  stat_now(&after);
+  printf("anon pages %lu -> %lu after the last unmap\n", before.anon, after.anon);
+  check(after.anon < before.anon + NPAGES / 2, "pages not freed");
+}
+
+int main(int argc, char *argv[]) {
+  printf("== Shared Anonymous Memory Test Start ==\n");
+
+  test_fork();
+  test_producer_consumer();
+  test_free();
+
+  printf("\n== All shared anonymous memory tests passed ==\n");
+  exit(0);
+}
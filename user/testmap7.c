@@ -0,0 +1,76 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/memstat.h"
+#include "user.h"
+
+#define PGSIZE         4096
+#define PROT_READ      0x1
+#define PROT_WRITE     0x2
+#define MAP_ANONYMOUS  0x1
+#define MAP_POPULATE   0x2
+
+#define NMAPPG         16
+
+void check(int cond, char *msg) {
+  if (!cond) {
+    printf("FAIL: %s\n", msg);
+    exit(1);
+  }
+}
+
+// Grow the heap past the size of physical memory, touching every
+// page, then read it all back. An anonymous mapping made before
+// the heap grows goes cold and must survive a trip through swap too.
+void test_swap_more_than_ram() {
+  printf("\n[1] Allocate more than physical memory\n");
+  struct memstat before, after;
+
+  check(memstat(&before, 0, 0) >= 0, "memstat");
+  check(before.swaptotal > 0, "no swap area");
+
+  int *m = (int*)mmap(0, NMAPPG * PGSIZE, PROT_READ | PROT_WRITE,
+                      MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  check(m != 0, "mmap");
+  for (int i = 0; i < NMAPPG; i++)
+    m[i * PGSIZE / sizeof(int)] = -i;
+
+  int npages = before.total + 1024;
+  check(npages < before.free + before.swaptotal - 1024, "swap area too small");
+  char *base = sbrk(0);
+  for (int i = 0; i < npages; i++) {
+    char *p = sbrk(PGSIZE);
+    check(p != (char*)-1, "sbrk failed");
+    *(int*)p = i;
+    p[PGSIZE - 1] = i & 0xff;
+    if (i % 4096 == 0)
+      printf("allocated %d of %d pages\n", i, npages);
+  }
+
+  for (int i = 0; i < npages; i++) {
+    char *p = base + (uint64)i * PGSIZE;
+    check(*(int*)p == i && p[PGSIZE - 1] == (char)(i & 0xff), "heap page lost");
+  }
+  for (int i = 0; i < NMAPPG; i++)
+    check(m[i * PGSIZE / sizeof(int)] == -i, "mmap page lost");
+
+  check(memstat(&after, 0, 0) >= 0, "memstat");
+  printf("swapped out %lu pages, swapped in %lu pages\n",
+         after.nswapout - before.nswapout, after.nswapin - before.nswapin);
+  check(after.nswapout > before.nswapout, "nothing swapped out");
+  check(after.nswapin > before.nswapin, "nothing swapped in");
+
+  sbrk(-(npages * PGSIZE));
+  check(munmap((uint64)m) == 1, "munmap");
+
+  check(memstat(&after, 0, 0) >= 0, "memstat");
+  check(after.swapused <= before.swapused, "swap slots leaked");
+}
+
+int main() {
+  printf("== Swap Test Start ==\n");
+
+  test_swap_more_than_ram();
+
+  printf("\n== All swap tests passed ==\n");
+  exit(0);
+}
@@ -0,0 +1,151 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user.h"
+
+#define PGSIZE         4096
+#define PROT_READ      0x1
+#define PROT_WRITE     0x2
+#define MAP_ANONYMOUS  0x1
+#define MAP_POPULATE   0x2
+
+#define NHEAPPG        1024
+#define NMAPPG         16
+#define MAXFORKPG      32   // page tables, kernel stack, trapframe
+
+void check(int cond, char *msg) {
+  if (!cond) {
+    printf("FAIL: %s\n", msg);
+    exit(1);
+  }
+}
+
+int *heap;
+
+void wait_ok(char *msg) {
+  int status;
+  check(wait(&status) > 0, "wait");
+  check(status == 0, msg);
+}
+
+// Fork a process with a large heap. The child should start out
+// sharing every page with the parent, and writes on either side
+// should not be seen by the other.
+void test_cow_heap() {
+  printf("\n[1] Heap pages are shared until written\n");
+  int go[2], done[2];
+  char c;
+
+  heap = (int*)sbrk(NHEAPPG * PGSIZE);
+  check(heap != (int*)-1, "sbrk");
+  for (int i = 0; i < NHEAPPG; i++)
+    heap[i * PGSIZE / sizeof(int)] = i;
+  check(pipe(go) == 0 && pipe(done) == 0, "pipe");
+
+  int before = freemem();
+  int pid = fork();
+  check(pid >= 0, "fork");
+  if (pid == 0) {
+    int used = before - freemem();
+    printf("fork of a %d page heap used %d pages\n", NHEAPPG, used);
+    check(used < MAXFORKPG, "fork copied the heap");
+    for (int i = 0; i < NHEAPPG; i += 2)
+      heap[i * PGSIZE / sizeof(int)] = -i;
+    write(done[1], "w", 1);
+    read(go[0], &c, 1);
+    for (int i = 0; i < NHEAPPG; i++)
+      check(heap[i * PGSIZE / sizeof(int)] == (i % 2 ? i : -i), "child sees parent's write");
+    exit(0);
+  }
+
+  read(done[0], &c, 1);
+  for (int i = 0; i < NHEAPPG; i++)
+    check(heap[i * PGSIZE / sizeof(int)] == i, "parent sees child's write");
+  for (int i = 1; i < NHEAPPG; i += 2)
+    heap[i * PGSIZE / sizeof(int)] = i;   // already this value, but now private
+  write(go[1], "g", 1);
+  wait_ok("child heap check");
+  close(go[0]); close(go[1]); close(done[0]); close(done[1]);
+}
+
+// The same for a private anonymous mapping.
+void test_cow_mmap() {
+  printf("\n[2] mmap pages are shared until written\n");
+  int *m = (int*)mmap(0, NMAPPG * PGSIZE, PROT_READ | PROT_WRITE,
+                      MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  check(m != 0, "mmap");
+  for (int i = 0; i < NMAPPG; i++)
+    m[i * PGSIZE / sizeof(int)] = i;
+
+  int pid = fork();
+  check(pid >= 0, "fork");
+  if (pid == 0) {
+    for (int i = 0; i < NMAPPG; i++)
+      m[i * PGSIZE / sizeof(int)] = 100 + i;
+    for (int i = 0; i < NMAPPG; i++)
+      check(m[i * PGSIZE / sizeof(int)] == 100 + i, "child mmap write lost");
+    exit(0);
+  }
+  wait_ok("child mmap check");
+  for (int i = 0; i < NMAPPG; i++)
+    check(m[i * PGSIZE / sizeof(int)] == i, "parent sees child's mmap write");
+  check(munmap((uint64)m) == 1, "munmap");
+}
+
+// A system call that writes into a shared page (here read()
+// from a pipe) must copy it, just like a store from user space.
+void test_cow_copyout() {
+  printf("\n[3] Kernel writes into shared pages\n");
+  int fds[2];
+
+  check(pipe(fds) == 0, "pipe");
+  heap[0] = 12345;
+  int pid = fork();
+  check(pid >= 0, "fork");
+  if (pid == 0) {
+    check(read(fds[0], heap, sizeof(int)) == sizeof(int), "child read");
+    check(heap[0] == 67890, "child read wrong data");
+    exit(0);
+  }
+  int v = 67890;
+  check(write(fds[1], &v, sizeof(v)) == sizeof(v), "write");
+  wait_ok("child copyout check");
+  check(heap[0] == 12345, "parent sees child's read()");
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// Fork and exit repeatedly with a small and a large heap. Without
+// copying, the time should not grow much with the heap size.
+void test_fork_time() {
+  printf("\n[4] fork time\n");
+  int n = 100;
+
+  sbrk(-(NHEAPPG * PGSIZE));
+  for (int big = 0; big < 2; big++) {
+    if (big)
+      check(sbrk(NHEAPPG * PGSIZE) != (char*)-1, "sbrk");
+    int t0 = uptime();
+    for (int i = 0; i < n; i++) {
+      int pid = fork();
+      check(pid >= 0, "fork");
+      if (pid == 0)
+        exit(0);
+      wait_ok("child exit");
+    }
+    printf("%d forks with a %d page heap: %d ticks\n", n,
+           big ? NHEAPPG : 0, uptime() - t0);
+  }
+  sbrk(-(NHEAPPG * PGSIZE));
+}
+
+int main() {
+  printf("== Copy-on-write Fork Test Start ==\n");
+
+  test_cow_heap();
+  test_cow_mmap();
+  test_cow_copyout();
+  test_fork_time();
+
+  printf("\n== All copy-on-write tests passed ==\n");
+  exit(0);
+}
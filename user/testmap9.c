@@ -0,0 +1,107 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+#define PGSIZE         4096
+#define MMAPBASE       0x40000000UL
+
+#define NHEAPPG        4096
+#define NTOUCH         8
+#define SLACK          16   // page-table pages
+
+void check(int cond, char *msg) {
+  if (!cond) {
+    printf("FAIL: %s\n", msg);
+    exit(1);
+  }
+}
+
+// Growing the heap should cost nothing until pages are touched,
+// and shrinking it should give back only the touched pages.
+void test_lazy_grow() {
+  printf("\n[1] sbrk allocates on first touch\n");
+  int before = freemem();
+  char *base = sbrk(NHEAPPG * PGSIZE);
+  check(base != (char*)-1, "sbrk");
+  int grown = freemem();
+  printf("sbrk of %d pages used %d pages\n", NHEAPPG, before - grown);
+  check(before - grown < SLACK, "sbrk allocated eagerly");
+
+  // The first pages share their 2MB with the program text, so
+  // they are mapped one 4KB page at a time, not as a megapage.
+  for (int i = 0; i < NTOUCH; i++)
+    check(base[i * PGSIZE] == 0, "new page not zero");
+  int touched = freemem();
+  printf("touching %d pages used %d pages\n", NTOUCH, grown - touched);
+  check(grown - touched >= NTOUCH && grown - touched < NTOUCH + SLACK,
+        "touch did not allocate one page each");
+
+  sbrk(-(NHEAPPG * PGSIZE));
+  check(freemem() >= touched + NTOUCH, "shrink did not free touched pages");
+}
+
+// System calls that read or write untouched heap pages must
+// fault them in rather than fail.
+void test_lazy_syscalls() {
+  printf("\n[2] System calls on untouched heap pages\n");
+  char *a = sbrk(2 * PGSIZE);
+  check(a != (char*)-1, "sbrk");
+
+  int fd = open("lazyfile", O_CREATE | O_RDWR);
+  check(fd >= 0, "open");
+  check(write(fd, a, PGSIZE) == PGSIZE, "write from untouched page");
+  close(fd);
+  fd = open("lazyfile", O_RDONLY);
+  check(fd >= 0, "open");
+  check(read(fd, a + PGSIZE, PGSIZE) == PGSIZE, "read into untouched page");
+  close(fd);
+  for (int i = 0; i < PGSIZE; i++)
+    check(a[PGSIZE + i] == 0, "wrong data read back");
+  unlink("lazyfile");
+
+  // A child forked before the heap is touched gets zero pages too.
+  char *b = sbrk(PGSIZE);
+  int pid = fork();
+  check(pid >= 0, "fork");
+  if (pid == 0) {
+    check(b[0] == 0, "child page not zero");
+    b[0] = 1;
+    exit(0);
+  }
+  int status;
+  wait(&status);
+  check(status == 0, "child failed");
+  check(b[0] == 0, "parent sees child's write");
+  sbrk(-3 * PGSIZE);
+}
+
+// The heap must not grow into the mmap region, and addresses past
+// the end of the heap are still invalid.
+void test_lazy_limits() {
+  printf("\n[3] Heap limits\n");
+  char *top = sbrk(0);
+  check(sbrk(MMAPBASE - (uint64)top + PGSIZE) == (char*)-1, "heap grew into mmap region");
+  check(sbrk(0) == top, "failed sbrk changed the heap");
+
+  int pid = fork();
+  check(pid >= 0, "fork");
+  if (pid == 0) {
+    top[PGSIZE] = 1;   // should be killed
+    exit(0);
+  }
+  int status;
+  wait(&status);
+  check(status == -1, "access past the heap was not fatal");
+}
+
+int main() {
+  printf("== Lazy sbrk Test Start ==\n");
+
+  test_lazy_grow();
+  test_lazy_syscalls();
+  test_lazy_limits();
+
+  printf("\n== All lazy sbrk tests passed ==\n");
+  exit(0);
+}
@@ -0,0 +1,111 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/memstat.h"
+#include "user/user.h"
+
+// TLB microbenchmark. Run it on a normal kernel and on one
+// built with make clean; make NOASID=1 qemu, which flushes the
+// TLB on every switch (memstat shows which is running), and
+// compare the tick counts.
+//
+// switch: two processes take turns over a pair of pipes, each
+//         touching its own working set of pages every turn. With
+//         ASIDs their TLB entries survive the context switches.
+// fault:  map and touch a small anonymous area over and over.
+//         Each fault flushes one TLB entry instead of all of them.
+
+#define PGSIZE         4096
+#define PROT_READ      0x1
+#define PROT_WRITE     0x2
+#define MAP_ANONYMOUS  0x1
+
+#define WSPAGES        32
+#define NSWITCH        2000
+#define FAULTPAGES     64
+#define NFAULTRUN      200
+
+char ws[WSPAGES * PGSIZE];
+
+static void
+touch(int round)
+{
+  for(int i = 0; i < WSPAGES; i++)
+    ws[i * PGSIZE] += round;
+}
+
+static int
+bench_switch(void)
+{
+  int ping[2], pong[2];
+  char c = 0;
+
+  if(pipe(ping) < 0 || pipe(pong) < 0){
+    fprintf(2, "tlbbench: pipe failed\n");
+    exit(1);
+  }
+  touch(0);
+  int t0 = uptime();
+  int pid = fork();
+  if(pid < 0){
+    fprintf(2, "tlbbench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    for(int i = 0; i < NSWITCH; i++){
+      read(ping[0], &c, 1);
+      touch(i);
+      write(pong[1], &c, 1);
+    }
+    exit(0);
+  }
+  for(int i = 0; i < NSWITCH; i++){
+    write(ping[1], &c, 1);
+    read(pong[0], &c, 1);
+    touch(i);
+  }
+  wait(0);
+  close(ping[0]); close(ping[1]);
+  close(pong[0]); close(pong[1]);
+  return uptime() - t0;
+}
+
+static int
+bench_fault(void)
+{
+  int t0 = uptime();
+  for(int r = 0; r < NFAULTRUN; r++){
+    char *m = (char*)mmap(0, FAULTPAGES * PGSIZE, PROT_READ | PROT_WRITE,
+                          MAP_ANONYMOUS, -1, 0);
+    if(m == 0){
+      fprintf(2, "tlbbench: mmap failed\n");
+      exit(1);
+    }
+    for(int i = 0; i < FAULTPAGES; i++)
+      m[i * PGSIZE] = i;
+    munmap((uint64)m);
+  }
+  return uptime() - t0;
+}
+
+int
+main(void)
+{
+  struct memstat before, after;
+
+  memstat(&before, 0, 0);
+  if(before.asids)
+    printf("asids: %lu per hart\n", before.asids);
+  else
+    printf("asids: none\n");
+
+  int ts = bench_switch();
+  printf("switch: %d round trips, %d pages each turn: %d ticks\n",
+         NSWITCH, WSPAGES, ts);
+
+  int tf = bench_fault();
+  printf("fault: %d faults: %d ticks\n", NFAULTRUN * FAULTPAGES, tf);
+
+  memstat(&after, 0, 0);
+  printf("asid rollovers: %lu\n", after.nasidroll - before.nasidroll);
+  exit(0);
+}
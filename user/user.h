@@ -5,6 +5,9 @@ typedef unsigned int uint;
 typedef unsigned long uint64;
 
 struct stat;
+struct slabstat;
+struct memstat;
+struct kallocsite;
 
 // system calls
 int fork(void);
@@ -36,6 +39,13 @@ int waitpid(int, int*);
 uint64 mmap(uint64 addr, int length, int prot, int flags, int fd, int offset);
 int munmap(uint64 addr);
 int freemem(void);
+int slabinfo(struct slabstat*, int);
+int memstat(struct memstat*, struct kallocsite*, int);
+int msync(uint64 addr, int length);
+int madvise(uint64 addr, int length, int advice);
+int mprotect(uint64 addr, int length, int prot);
+int munmaprange(uint64 addr, int length);
+uint64 mremap(uint64 addr, int oldlen, int newlen);
 
 // ulib.c
 int stat(const char*, struct stat*);
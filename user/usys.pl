@@ -44,3 +44,10 @@ entry("waitpid");
 entry("mmap");
 entry("munmap");
 entry("freemem");
+entry("slabinfo");
+entry("memstat");
+entry("msync");
+entry("madvise");
+entry("mprotect");
+entry("munmaprange");
+entry("mremap");